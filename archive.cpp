@@ -0,0 +1,342 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+#include <cstdlib>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "helpers.hpp"
+
+using namespace std;
+
+// Blobs are read in windows of at most this many bytes while the previous window
+// is written; anything larger is copied from the object store in chunks.
+const size_t ARCHIVE_WINDOW_BYTES = 32 << 20;
+const size_t ARCHIVE_WINDOW_FILES = 256;
+const size_t ARCHIVE_CHUNK = 1 << 20;
+
+// Where the tar stream goes: a plain file or stdout, zlib, or a zstd pipe
+struct ArchiveSink
+{
+    FILE *file = nullptr;
+    gzFile gz = nullptr;
+    bool piped = false;
+    bool ok = true;
+
+    void write(const char *data, size_t size)
+    {
+        if (!ok || size == 0)
+            return;
+        if (gz)
+            ok = gzwrite(gz, data, size) == (int)size;
+        else
+            ok = fwrite(data, 1, size, file) == size;
+    }
+
+    bool close()
+    {
+        if (gz)
+            return gzclose(gz) == Z_OK && ok;
+        if (piped)
+            return pclose(file) == 0 && ok;
+        if (file == stdout)
+            return fflush(stdout) == 0 && ok;
+        return fclose(file) == 0 && ok;
+    }
+};
+
+static bool endsWith(const string &s, const string &suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Whether an executable of that name is on PATH
+static bool commandExists(const string &name)
+{
+    const char *path = getenv("PATH");
+    istringstream dirs(path ? path : "");
+    for (string dir; getline(dirs, dir, ':');)
+    {
+        if (access(((dir.empty() ? "." : dir) + "/" + name).c_str(), X_OK) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool openSink(const string &outputFile, ArchiveSink &sink)
+{
+    if (outputFile.empty() || outputFile == "-")
+        sink.file = stdout;
+    else if (endsWith(outputFile, ".zst"))
+    {
+        // zstd is not linked in; its command line tool compresses on another core
+        if (!commandExists("zstd"))
+        {
+            cerr << "Error: zstd is not installed; cannot write " << outputFile << "\n";
+            return false;
+        }
+        // If zstd dies, writes to the pipe then fail instead of killing us with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        string quoted = "'";
+        for (char c : outputFile)
+            quoted += c == '\'' ? string("'\\''") : string(1, c);
+        quoted += "'";
+        sink.file = popen(("zstd -q -f -o " + quoted).c_str(), "w");
+        sink.piped = true;
+    }
+    else if (endsWith(outputFile, ".gz") || endsWith(outputFile, ".tgz"))
+    {
+        sink.gz = gzopen(outputFile.c_str(), "wb");
+        if (sink.gz)
+            gzbuffer(sink.gz, ARCHIVE_CHUNK);
+        return sink.gz != nullptr;
+    }
+    else
+        sink.file = fopen(outputFile.c_str(), "wb");
+    return sink.file != nullptr;
+}
+
+static void setOctal(char *field, size_t width, unsigned long long value)
+{
+    snprintf(field, width, "%0*llo", (int)width - 1, value);
+}
+
+static void writeHeader(ArchiveSink &sink, const string &name, char type, size_t size, time_t mtime)
+{
+    char header[512] = {};
+    string prefix, shortName = name;
+    if (name.size() > 100)
+    {
+        size_t split = name.rfind('/', 155);
+        if (split != string::npos && name.size() - split - 1 <= 100)
+        {
+            prefix = name.substr(0, split);
+            shortName = name.substr(split + 1);
+        }
+    }
+    memcpy(header, shortName.data(), min<size_t>(shortName.size(), 100));
+    setOctal(header + 100, 8, type == '5' ? 0755 : 0644);
+    setOctal(header + 108, 8, 0);
+    setOctal(header + 116, 8, 0);
+    setOctal(header + 124, 12, size);
+    setOctal(header + 136, 12, mtime);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, prefix.data(), min<size_t>(prefix.size(), 155));
+
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (unsigned char c : header)
+        checksum += c;
+    snprintf(header + 148, 8, "%06o", checksum);
+    sink.write(header, sizeof(header));
+}
+
+static void writePadding(ArchiveSink &sink, size_t size)
+{
+    static const char zeros[512] = {};
+    if (size % 512)
+        sink.write(zeros, 512 - size % 512);
+}
+
+// One pax extended header record, "<length> <key>=<value>\n", where length counts itself
+static string paxRecord(const string &key, const string &value)
+{
+    string record = " " + key + "=" + value + "\n";
+    size_t length = record.size();
+    while (to_string(length).size() + record.size() != length)
+        length = to_string(length).size() + record.size();
+    return to_string(length) + record;
+}
+
+// Writes the header for one file, preceded by pax records for a path or size that does
+// not fit ustar: the size field holds 11 octal digits, so files of 8 GiB or more need one
+static void writeEntryHeader(ArchiveSink &sink, const string &path, uintmax_t size, time_t mtime)
+{
+    const uintmax_t maxUstarSize = 077777777777ULL;
+    bool fits = path.size() <= 100 || (path.rfind('/', 155) != string::npos && path.size() - path.rfind('/', 155) - 1 <= 100);
+    string records;
+    if (!fits)
+        records += paxRecord("path", path);
+    if (size > maxUstarSize)
+        records += paxRecord("size", to_string(size));
+    if (!records.empty())
+    {
+        writeHeader(sink, "PaxHeader", 'x', records.size(), mtime);
+        sink.write(records.data(), records.size());
+        writePadding(sink, records.size());
+    }
+    writeHeader(sink, fits ? path : path.substr(0, 100), '0', size > maxUstarSize ? 0 : size, mtime);
+}
+
+static time_t commitTime(const string &commitContent)
+{
+    istringstream lines(commitContent);
+    string line;
+    while (getline(lines, line))
+    {
+        if (line.rfind("date ", 0) == 0)
+        {
+            tm parsed = {};
+            istringstream date(line.substr(5));
+            date >> get_time(&parsed, "%Y-%m-%d %H:%M:%S");
+            if (!date.fail())
+            {
+                parsed.tm_isdst = -1;
+                return mktime(&parsed);
+            }
+        }
+    }
+    return time(nullptr);
+}
+
+// Copies an object that is too large for a window in fixed-size chunks
+static bool streamLargeObject(ArchiveSink &sink, const string &hash, ObjectLocation location)
+{
+    int fd = open(location.path.c_str(), O_RDONLY);
+    if (fd < 0 && relocateObject(hash, location))
+        fd = open(location.path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    vector<char> buffer(ARCHIVE_CHUNK);
+    uintmax_t done = 0;
+    while (done < location.size && sink.ok)
+    {
+        ssize_t n = pread(fd, buffer.data(), min<uintmax_t>(buffer.size(), location.size - done), location.offset + done);
+        if (n <= 0)
+            break;
+        sink.write(buffer.data(), n);
+        done += n;
+    }
+    close(fd);
+    return done == location.size;
+}
+
+/**
+ * @brief Writes the tree of a commit as a tar archive, without a checkout.
+ *
+ * Blobs are streamed from the object store. Small blobs are read in bounded
+ * windows, and the next window is read in the background while the current
+ * one is written. Blobs larger than a window are copied in chunks. Memory use
+ * therefore stays constant whatever the size of the tree.
+ *
+ * @param commitRef Branch or commit to export.
+ * @param outputFile Archive to write; ".gz"/".tgz" is gzip-compressed, ".zst"
+ * is piped through zstd, and an empty name or "-" writes to stdout.
+ */
+void archiveCommit(const string &commitRef, const string &outputFile)
+{
+    string commit = resolveCommitish(commitRef);
+    if (commit.empty())
+    {
+        cerr << "Error: No such branch or commit: " << commitRef << "\n";
+        return;
+    }
+    string commitContent = readObject(commit);
+    map<string, string> files = parseTreeObject(readObject(getTreeHashFromCommit(commitContent)));
+    time_t mtime = commitTime(commitContent);
+
+    vector<string> blobs;
+    for (const auto &[path, hash] : files)
+        blobs.push_back(hash);
+    fetchPromisedObjects(blobs); // one batch for a partial repository, instead of one per blob
+
+    vector<string> paths, hashes;
+    vector<ObjectLocation> locations;
+    for (const auto &[path, hash] : files)
+    {
+        ObjectLocation location;
+        if (!locateObject(hash, location))
+        {
+            cerr << "Error: missing blob " << hash << " for " << path << "\n";
+            return;
+        }
+        paths.push_back(path);
+        hashes.push_back(hash);
+        locations.push_back(location);
+    }
+
+    // Split the files into windows; a blob larger than a window is a window of its own
+    vector<pair<size_t, size_t>> windows;
+    for (size_t begin = 0; begin < paths.size();)
+    {
+        size_t end = begin;
+        uintmax_t bytes = 0;
+        while (end < paths.size() && end - begin < ARCHIVE_WINDOW_FILES)
+        {
+            uintmax_t size = locations[end].size;
+            if (end > begin && bytes + size > ARCHIVE_WINDOW_BYTES)
+                break;
+            bytes += size;
+            end++;
+            if (size > ARCHIVE_WINDOW_BYTES)
+                break;
+        }
+        windows.emplace_back(begin, end);
+        begin = end;
+    }
+
+    auto prefetch = [&](size_t w)
+    {
+        auto [begin, end] = windows[w];
+        if (end - begin == 1 && locations[begin].size > ARCHIVE_WINDOW_BYTES)
+            return vector<string>(); // streamed in chunks instead
+        return readObjectsBatch(vector<string>(hashes.begin() + begin, hashes.begin() + end));
+    };
+
+    ArchiveSink sink;
+    if (!openSink(outputFile, sink))
+    {
+        cerr << "Error: Could not create archive: " << outputFile << "\n";
+        return;
+    }
+
+    future<vector<string>> next;
+    if (!windows.empty())
+        next = async(launch::async, prefetch, 0);
+    bool complete = true;
+    for (size_t w = 0; w < windows.size() && sink.ok && complete; ++w)
+    {
+        vector<string> blobs = next.get();
+        if (w + 1 < windows.size())
+            next = async(launch::async, prefetch, w + 1);
+
+        auto [begin, end] = windows[w];
+        for (size_t i = begin; i < end && complete; ++i)
+        {
+            writeEntryHeader(sink, paths[i], locations[i].size, mtime);
+            if (blobs.empty())
+                complete = streamLargeObject(sink, hashes[i], locations[i]);
+            else if (blobs[i - begin].size() != locations[i].size)
+                complete = false;
+            else
+                sink.write(blobs[i - begin].data(), blobs[i - begin].size());
+            writePadding(sink, locations[i].size);
+        }
+    }
+    if (next.valid())
+        next.wait();
+
+    static const char trailer[1024] = {};
+    sink.write(trailer, sizeof(trailer));
+    if (!sink.close() || !complete)
+    {
+        cerr << "Error: Failed to write archive" << (outputFile.empty() ? "" : " " + outputFile) << "\n";
+        if (!outputFile.empty() && outputFile != "-")
+            remove(outputFile.c_str());
+        return;
+    }
+    if (!outputFile.empty() && outputFile != "-")
+        cout << "Archived " << paths.size() << " files from " << commit << " into " << outputFile << "\n";
+}
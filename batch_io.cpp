@@ -0,0 +1,479 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "helpers.hpp"
+
+// Build with -DMINIGIT_HAVE_LIBURING (and link -luring) to move file data through
+// io_uring; setting "ioBackend = threads" in .minigit/config turns it off again
+#ifdef MINIGIT_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Files are opened, transferred and closed in groups of this size
+const size_t BATCH_SIZE = 256;
+
+struct IoRequest
+{
+    int fd = -1;
+    char *buffer = nullptr;
+    size_t length = 0;
+    size_t done = 0;
+    bool write = false;
+};
+
+// Moves the rest of one request with plain pread/pwrite
+static void moveData(IoRequest &req)
+{
+    while (req.done < req.length)
+    {
+        ssize_t n = req.write ? pwrite(req.fd, req.buffer + req.done, req.length - req.done, req.done)
+                              : pread(req.fd, req.buffer + req.done, req.length - req.done, req.done);
+        if (n <= 0)
+            return;
+        req.done += n;
+    }
+}
+
+/**
+ * @brief Moves the data of successive batches of open files.
+ *
+ * One is set up per readFilesBatch or writeFilesBatch call, so its worker threads
+ * and io_uring ring are reused by every batch instead of being created per batch.
+ * Whatever the ring leaves unfinished is retried on the threads, so a request that
+ * still has done < length after run() has failed.
+ */
+class BatchTransfer
+{
+public:
+    explicit BatchTransfer(size_t fileCount)
+    {
+#ifdef MINIGIT_HAVE_LIBURING
+        if (get_config_value("ioBackend") != "threads")
+            ringReady = io_uring_queue_init(BATCH_SIZE, &ring, 0) == 0;
+#endif
+        size_t count = min<size_t>({max(1u, thread::hardware_concurrency()), fileCount, BATCH_SIZE});
+        if (count > 1)
+        {
+            for (size_t w = 0; w < count; ++w)
+                workers.emplace_back([this]()
+                                     { work(); });
+        }
+    }
+
+    ~BatchTransfer()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+#ifdef MINIGIT_HAVE_LIBURING
+        if (ringReady)
+            io_uring_queue_exit(&ring);
+#endif
+    }
+
+    void run(vector<IoRequest> &requests)
+    {
+#ifdef MINIGIT_HAVE_LIBURING
+        if (ringReady)
+            uringRun(requests);
+#endif
+        if (workers.empty())
+        {
+            for (auto &req : requests)
+                moveData(req);
+            return;
+        }
+        unique_lock<mutex> guard(lock);
+        batch = &requests;
+        next = 0;
+        busy = workers.size();
+        generation++;
+        wake.notify_all();
+        finished.wait(guard, [this]()
+                      { return busy == 0; });
+        batch = nullptr;
+    }
+
+private:
+    void work()
+    {
+        size_t seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [&]()
+                      { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            vector<IoRequest> &requests = *batch;
+            guard.unlock();
+            for (size_t i = next++; i < requests.size(); i = next++)
+                moveData(requests[i]);
+            guard.lock();
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+#ifdef MINIGIT_HAVE_LIBURING
+    // Queues every request on the ring and resubmits short transfers. Once anything
+    // goes wrong nothing more is queued, but every submitted request is still reaped
+    // before returning: the kernel may write into the buffers until its CQE arrives.
+    void uringRun(vector<IoRequest> &requests)
+    {
+        bool ok = true;
+        size_t nextRequest = 0, queued = 0, inFlight = 0;
+        vector<size_t> retry;
+        auto queue = [&](size_t i)
+        {
+            IoRequest &req = requests[i];
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            if (!sqe)
+                return false;
+            if (req.write)
+                io_uring_prep_write(sqe, req.fd, req.buffer + req.done, req.length - req.done, req.done);
+            else
+                io_uring_prep_read(sqe, req.fd, req.buffer + req.done, req.length - req.done, req.done);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(i));
+            queued++;
+            return true;
+        };
+
+        while (true)
+        {
+            while (ok && queued + inFlight < BATCH_SIZE && !retry.empty() && queue(retry.back()))
+                retry.pop_back();
+            while (ok && queued + inFlight < BATCH_SIZE && nextRequest < requests.size())
+            {
+                if (requests[nextRequest].done < requests[nextRequest].length && !queue(nextRequest))
+                    break;
+                nextRequest++;
+            }
+            if (ok && queued > 0)
+            {
+                // Entries that never reach the kernel are dropped by io_uring_queue_exit
+                int submitted = io_uring_submit(&ring);
+                if (submitted <= 0)
+                    ok = false;
+                else
+                {
+                    queued -= submitted;
+                    inFlight += submitted;
+                }
+            }
+            if (inFlight == 0)
+                break;
+
+            struct io_uring_cqe *cqe;
+            int waited;
+            do
+                waited = io_uring_wait_cqe(&ring, &cqe);
+            while (waited == -EINTR || waited == -EAGAIN || waited == -EBUSY);
+            if (waited < 0)
+            {
+                // Returning would hand buffers the kernel may still fill back to the caller
+                cerr << "Fatal: lost track of " << inFlight << " io_uring requests\n";
+                abort();
+            }
+
+            unsigned head, seen = 0;
+            io_uring_for_each_cqe(&ring, head, cqe)
+            {
+                size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+                seen++;
+                inFlight--;
+                if (cqe->res <= 0)
+                {
+                    ok = false;
+                    continue;
+                }
+                requests[i].done += cqe->res;
+                if (requests[i].done < requests[i].length)
+                    retry.push_back(i);
+            }
+            io_uring_cq_advance(&ring, seen);
+        }
+
+        // A broken ring is not used for later batches; the threads take over
+        if (!ok)
+        {
+            io_uring_queue_exit(&ring);
+            ringReady = false;
+        }
+    }
+
+    struct io_uring ring;
+    bool ringReady = false;
+#endif
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    vector<IoRequest> *batch = nullptr;
+    atomic<size_t> next{0};
+    size_t busy = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
+
+/**
+ * @brief Reads many files at once.
+ *
+ * Files are opened and sized in batches, and each batch's data is moved through
+ * io_uring or a thread pool. A file that cannot be opened or is not read in full
+ * yields an empty string, like readFile, and is flagged in failed.
+ *
+ * @param paths Files to read.
+ * @param failed If given, set to one flag per path telling whether its read failed.
+ * @return The contents, in the same order as paths.
+ */
+vector<string> readFilesBatch(const vector<string> &paths, vector<bool> *failed)
+{
+    vector<string> contents(paths.size());
+    if (failed)
+        failed->assign(paths.size(), false);
+    auto fail = [&](size_t i)
+    {
+        contents[i].clear();
+        if (failed)
+            (*failed)[i] = true;
+    };
+
+    BatchTransfer transfer(paths.size());
+    for (size_t begin = 0; begin < paths.size(); begin += BATCH_SIZE)
+    {
+        size_t end = min(paths.size(), begin + BATCH_SIZE);
+        vector<IoRequest> requests;
+        vector<size_t> owners;
+        for (size_t i = begin; i < end; ++i)
+        {
+            int fd = open(paths[i].c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                fail(i);
+                continue;
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0)
+            {
+                close(fd);
+                fail(i);
+                continue;
+            }
+            contents[i].resize(st.st_size);
+            IoRequest req;
+            req.fd = fd;
+            req.buffer = contents[i].data();
+            req.length = st.st_size;
+            requests.push_back(req);
+            owners.push_back(i);
+        }
+
+        transfer.run(requests);
+        for (size_t r = 0; r < requests.size(); ++r)
+        {
+            close(requests[r].fd);
+            if (requests[r].done < requests[r].length)
+                fail(owners[r]);
+        }
+    }
+    return contents;
+}
+
+/**
+ * @brief Writes many files at once, creating parent directories as needed.
+ *
+ * Uses the same batching as readFilesBatch.
+ *
+ * @param files (path, content) pairs to write.
+ * @throws runtime_error if any file cannot be written.
+ */
+void writeFilesBatch(const vector<pair<string, string>> &files)
+{
+    set<fs::path> parents;
+    for (const auto &[path, _] : files)
+    {
+        fs::path parent = fs::path(path).parent_path();
+        if (!parent.empty() && parents.insert(parent).second)
+            fs::create_directories(parent);
+    }
+
+    BatchTransfer transfer(files.size());
+    for (size_t begin = 0; begin < files.size(); begin += BATCH_SIZE)
+    {
+        size_t end = min(files.size(), begin + BATCH_SIZE);
+        vector<IoRequest> requests;
+        for (size_t i = begin; i < end; ++i)
+        {
+            int fd = open(files[i].first.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                for (auto &req : requests)
+                    close(req.fd);
+                throw runtime_error("Failed to write to file: " + files[i].first);
+            }
+            IoRequest req;
+            req.fd = fd;
+            req.buffer = const_cast<char *>(files[i].second.data());
+            req.length = files[i].second.size();
+            req.write = true;
+            requests.push_back(req);
+        }
+
+        transfer.run(requests);
+        string failedPath;
+        for (size_t r = 0; r < requests.size(); ++r)
+        {
+            close(requests[r].fd);
+            if (requests[r].done < requests[r].length && failedPath.empty())
+                failedPath = files[begin + r].first;
+        }
+        if (!failedPath.empty())
+            throw runtime_error("Failed to write to file: " + failedPath);
+    }
+}
+
+/**
+ * @brief Times batched against one-at-a-time file reads and writes.
+ *
+ * Writes fileCount small files into a scratch directory with writeFile and with
+ * writeFilesBatch, reads them back with readFile and readFilesBatch, and prints
+ * the time each took. The scratch directory is removed afterwards.
+ *
+ * @param fileCount Number of files to create.
+ */
+void benchmarkBatchIo(size_t fileCount)
+{
+    fs::path scratch = fs::temp_directory_path() / ("minigit-bench-" + to_string(getpid()));
+    vector<pair<string, string>> files;
+    vector<string> paths;
+    for (size_t i = 0; i < fileCount; ++i)
+    {
+        // 256 files per directory, like a source tree rather than one huge directory
+        string path = (scratch / to_string(i / 256) / ("file" + to_string(i))).string();
+        files.emplace_back(path, "content of file " + to_string(i) + "\n" + string(i % 4096, 'x'));
+        paths.push_back(path);
+    }
+
+    auto time = [](const function<void()> &fn)
+    {
+        auto start = chrono::steady_clock::now();
+        fn();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    auto report = [&](const string &label, double seconds)
+    {
+        cout << label << ": " << seconds << " s (" << (fileCount / max(seconds, 1e-9)) << " files/s)\n";
+    };
+
+    try
+    {
+        report("writeFile       ", time([&]()
+                                        { for (const auto &[path, content] : files) writeFile(path, content); }));
+        report("writeFilesBatch ", time([&]()
+                                        { writeFilesBatch(files); }));
+
+        size_t mismatched = 0;
+        report("readFile        ", time([&]()
+                                        { for (size_t i = 0; i < fileCount; ++i) mismatched += readFile(paths[i]) != files[i].second; }));
+        vector<bool> failed;
+        vector<string> contents;
+        report("readFilesBatch  ", time([&]()
+                                        { contents = readFilesBatch(paths, &failed); }));
+        for (size_t i = 0; i < fileCount; ++i)
+            mismatched += failed[i] || contents[i] != files[i].second;
+        if (mismatched > 0)
+            cerr << "Error: " << mismatched << " files read back with the wrong content\n";
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error: " << e.what() << "\n";
+    }
+    fs::remove_all(scratch);
+}
+
+/**
+ * @brief Copies a file without passing its data through userspace when possible.
+ *
+ * Tries a copy-on-write clone (FICLONE, supported by btrfs and XFS) first, then
+ * copy_file_range, and finally falls back to a buffered read/write copy. Objects
+ * are stored uncompressed, so checkout can clone them straight into the working tree.
+ *
+ * @param source The file to copy.
+ * @param destination The file to create or replace.
+ * @return true if the destination now holds a copy of the source.
+ */
+bool cloneFile(const string &source, const string &destination)
+{
+    int in = open(source.c_str(), O_RDONLY);
+    if (in < 0)
+        return false;
+    int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+    bool ok = ioctl(out, FICLONE, in) == 0;
+    if (!ok)
+    {
+        struct stat st;
+        ok = fstat(in, &st) == 0;
+        off_t remaining = ok ? st.st_size : 0;
+        while (ok && remaining > 0)
+        {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+            if (n <= 0)
+                break;
+            remaining -= n;
+        }
+
+        // Buffered copy for whatever copy_file_range could not handle
+        char buffer[1 << 16];
+        ssize_t n;
+        while (ok && remaining > 0 && (n = read(in, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t written = 0; written < n;)
+            {
+                ssize_t w = write(out, buffer + written, n - written);
+                if (w <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                written += w;
+            }
+            remaining -= n;
+        }
+        ok = ok && remaining <= 0;
+    }
+
+    close(in);
+    close(out);
+    return ok;
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <iomanip>
+#include <filesystem>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// The line-origin cache holds one file per blamed blob, blame-cache/<blob hash>,
+// listing for every line of the blob the commit that introduced it. Blaming a
+// file only walks history back to the newest version already in the cache.
+
+static string blameCachePath(const string &blobHash)
+{
+    return commonPath("blame-cache/" + blobHash);
+}
+
+static bool loadOrigins(const string &blobHash, size_t lineCount, vector<string> &origins)
+{
+    vector<string> cached = splitLines(readFile(blameCachePath(blobHash)));
+    if (cached.size() != lineCount)
+        return false;
+    origins = move(cached);
+    return true;
+}
+
+static void saveOrigins(const string &blobHash, const vector<string> &origins)
+{
+    string content;
+    for (const auto &commit : origins)
+        content += commit + "\n";
+    string path = blameCachePath(blobHash);
+    try
+    {
+        writeFile(path + ".tmp", content);
+        fs::rename(path + ".tmp", path);
+    }
+    catch (const exception &e)
+    {
+        // The cache is only an optimization
+    }
+}
+
+static string blobAt(const string &commitContent, const string &path)
+{
+    map<string, string> tree = parseTreeObject(readObject(getTreeHashFromCommit(commitContent)));
+    auto it = tree.find(path);
+    return it == tree.end() ? "" : it->second;
+}
+
+/**
+ * @brief Shows, for every line of a file at HEAD, the commit that last changed it.
+ *
+ * History is followed along first parents. Commits whose changed-path filter rules
+ * out the file are skipped without reading their trees, and only commits where the
+ * file's blob changed are diffed. The walk stops at the first version whose line
+ * origins are cached; origins are then carried forward version by version with
+ * diffLines and cached for every blob computed.
+ *
+ * @param path File to blame, relative to the top of the working tree.
+ */
+void blameFile(const string &path)
+{
+    string head = resolveCommitish("HEAD");
+    if (head.empty())
+    {
+        cerr << "fatal: no commits yet.\n";
+        return;
+    }
+    string headContent = readObject(head);
+    string blob = blobAt(headContent, path);
+    if (blob.empty())
+    {
+        cerr << "fatal: no such path '" << path << "' in HEAD\n";
+        return;
+    }
+
+    unordered_map<string, string> blooms = loadCommitBlooms();
+    vector<pair<string, string>> versions; // (commit that introduced the blob, blob), newest first
+    vector<string> origins;
+    vector<string> lines = splitLines(readObject(blob));
+    string baseBlob;
+
+    if (!loadOrigins(blob, lines.size(), origins))
+    {
+        string commit = head, content = headContent;
+        while (true)
+        {
+            vector<string> parents = get_commit_parents(content);
+            if (parents.empty())
+            {
+                versions.emplace_back(commit, blob);
+                break;
+            }
+            string parentContent = readObject(parents[0]);
+            auto filter = blooms.find(commit);
+            string parentBlob = (filter != blooms.end() && !bloomMightContain(filter->second, path))
+                                    ? blob
+                                    : blobAt(parentContent, path);
+            if (parentBlob != blob)
+            {
+                versions.emplace_back(commit, blob);
+                if (parentBlob.empty())
+                    break;
+                vector<string> parentLines = splitLines(readObject(parentBlob));
+                if (loadOrigins(parentBlob, parentLines.size(), origins))
+                {
+                    baseBlob = parentBlob;
+                    lines = move(parentLines);
+                    break;
+                }
+                blob = parentBlob;
+            }
+            commit = parents[0];
+            content = move(parentContent);
+        }
+
+        // Replay the versions oldest first, carrying line origins through each diff
+        if (baseBlob.empty())
+            lines.clear();
+        for (auto it = versions.rbegin(); it != versions.rend(); ++it)
+        {
+            const auto &[commit, versionBlob] = *it;
+            vector<string> newLines = splitLines(readObject(versionBlob));
+            vector<int> matches = diffLines(lines, newLines);
+            vector<string> newOrigins(newLines.size());
+            for (size_t j = 0; j < newLines.size(); ++j)
+                newOrigins[j] = matches[j] >= 0 ? origins[matches[j]] : commit;
+            saveOrigins(versionBlob, newOrigins);
+            lines = move(newLines);
+            origins = move(newOrigins);
+        }
+    }
+
+    unordered_map<string, pair<string, string>> commitInfo; // commit -> (author, date)
+    size_t authorWidth = 0;
+    for (const auto &commit : origins)
+    {
+        if (commitInfo.count(commit))
+            continue;
+        string author, date;
+        istringstream commitLines(readObject(commit));
+        string line;
+        while (getline(commitLines, line))
+        {
+            if (line.rfind("author ", 0) == 0)
+                author = line.substr(7, line.find(" <") == string::npos ? string::npos : line.find(" <") - 7);
+            else if (line.rfind("date ", 0) == 0)
+                date = line.substr(5);
+        }
+        authorWidth = max(authorWidth, author.size());
+        commitInfo[commit] = {author, date};
+    }
+
+    ostringstream out;
+    size_t numberWidth = to_string(lines.size()).size();
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        const auto &[author, date] = commitInfo[origins[i]];
+        out << origins[i].substr(0, 8) << " (" << left << setw(authorWidth) << author << " " << date << " "
+            << right << setw(numberWidth) << i + 1 << ") " << lines[i] << "\n";
+    }
+    cout << out.str();
+}
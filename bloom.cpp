@@ -0,0 +1,238 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <filesystem>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "helpers.hpp"
+#include "commands.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Filters live in info/commit-bloom, one line per commit: "<commit> <bit count> <hex bits>",
+// or "<commit> 0 *" when too many paths changed for a filter to be useful
+const int BLOOM_HASHES = 7;
+const size_t BLOOM_BITS_PER_PATH = 10;
+const size_t BLOOM_MAX_PATHS = 512;
+
+static uint64_t fnv1a(const string &data, uint64_t seed)
+{
+    uint64_t hash = 1469598103934665603ULL ^ seed;
+    for (unsigned char c : data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Double hashing: bit i = h1 + i * h2 (mod bit count)
+static vector<size_t> bloomPositions(const string &path, size_t bitCount)
+{
+    uint64_t h1 = fnv1a(path, 0);
+    uint64_t h2 = fnv1a(path, 0x9e3779b97f4a7c15ULL) | 1;
+    vector<size_t> positions;
+    for (int i = 0; i < BLOOM_HASHES; ++i)
+        positions.push_back((h1 + i * h2) % bitCount);
+    return positions;
+}
+
+static map<string, string> treeOfCommit(const string &commitContent)
+{
+    string treeHash = getTreeHashFromCommit(commitContent);
+    if (treeHash.empty())
+        return {};
+    return parseTreeObject(readObject(treeHash));
+}
+
+// Paths that differ between a commit and its first parent, plus their leading
+// directories so that directory-limited queries work too
+static set<string> changedPaths(const string &commitContent)
+{
+    map<string, string> tree = treeOfCommit(commitContent);
+    vector<string> parents = get_commit_parents(commitContent);
+    map<string, string> parentTree;
+    if (!parents.empty())
+        parentTree = treeOfCommit(readObject(parents[0]));
+
+    set<string> changed;
+    for (const auto &[path, hash] : tree)
+    {
+        auto it = parentTree.find(path);
+        if (it == parentTree.end() || it->second != hash)
+            changed.insert(path);
+    }
+    for (const auto &[path, _] : parentTree)
+    {
+        if (tree.count(path) == 0)
+            changed.insert(path);
+    }
+
+    set<string> withDirs = changed;
+    for (const auto &path : changed)
+    {
+        for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1))
+            withDirs.insert(path.substr(0, slash));
+    }
+    return withDirs;
+}
+
+static string buildBloomLine(const string &commitHash)
+{
+    set<string> paths = changedPaths(readObject(commitHash));
+    if (paths.size() > BLOOM_MAX_PATHS)
+        return commitHash + " 0 *\n";
+
+    size_t bitCount = max<size_t>(64, paths.size() * BLOOM_BITS_PER_PATH);
+    bitCount = (bitCount + 3) / 4 * 4;
+    vector<int> nibbles(bitCount / 4, 0);
+    for (const auto &path : paths)
+    {
+        for (size_t bit : bloomPositions(path, bitCount))
+            nibbles[bit / 4] |= 1 << (bit % 4);
+    }
+
+    string hex;
+    for (int nibble : nibbles)
+        hex += "0123456789abcdef"[nibble];
+    return commitHash + " " + to_string(bitCount) + " " + hex + "\n";
+}
+
+// Appends whole lines under an exclusive flock, so a commit recording its filter
+// and a maintenance run appending many never interleave within a line
+static bool appendBloomLines(const string &lines)
+{
+    if (lines.empty())
+        return true;
+    fs::create_directories(commonPath("info"));
+    int fd = open(commonPath("info/commit-bloom").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = flock(fd, LOCK_EX) == 0;
+    for (size_t written = 0; ok && written < lines.size();)
+    {
+        ssize_t n = write(fd, lines.data() + written, lines.size() - written);
+        ok = n > 0;
+        written += ok ? n : 0;
+    }
+    close(fd); // releases the lock
+    return ok;
+}
+
+/**
+ * @brief Records the changed-path Bloom filter of a freshly written commit.
+ *
+ * Called after a commit object is stored. Failures are not fatal: log falls back
+ * to comparing trees for commits without a filter.
+ *
+ * @param commitHash The commit whose changes against its first parent are recorded.
+ */
+void writeCommitBloom(const string &commitHash)
+{
+    appendBloomLines(buildBloomLine(commitHash));
+}
+
+// commit hash -> "<bit count> <hex bits>"
+unordered_map<string, string> loadCommitBlooms()
+{
+    unordered_map<string, string> filters;
+    ifstream file(commonPath("info/commit-bloom"));
+    string line;
+    while (getline(file, line))
+    {
+        size_t space = line.find(' ');
+        if (space != string::npos)
+            filters[line.substr(0, space)] = line.substr(space + 1);
+    }
+    return filters;
+}
+
+// False only when the commit certainly did not touch the path
+bool bloomMightContain(const string &filter, const string &path)
+{
+    istringstream iss(filter);
+    size_t bitCount = 0;
+    string hex;
+    iss >> bitCount >> hex;
+    if (bitCount == 0 || hex.size() * 4 != bitCount)
+        return true;
+
+    for (size_t bit : bloomPositions(path, bitCount))
+    {
+        char c = hex[bit / 4];
+        int nibble = (c >= 'a') ? c - 'a' + 10 : c - '0';
+        if (!(nibble & (1 << (bit % 4))))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Maintenance pass: computes filters for every reachable commit that lacks one.
+ *
+ * info/commit-bloom-covered lists the ref tips of the last complete pass, whose
+ * whole history has filters, so the walk stops there instead of re-reading all
+ * of history each run. Filters computed before the deadline are kept even when
+ * the pass is cut short; the covered tips are only recorded once it completes.
+ *
+ * @param deadline Filters not started by then are left for the next pass.
+ */
+void updateCommitBlooms(chrono::steady_clock::time_point deadline)
+{
+    unordered_map<string, string> existing = loadCommitBlooms();
+    unordered_set<string> covered;
+    istringstream coveredTips(readFile(commonPath("info/commit-bloom-covered")));
+    for (string tip; getline(coveredTips, tip);)
+        covered.insert(trim(tip));
+
+    vector<string> tips = getRefTips();
+    unordered_set<string> seen;
+    vector<string> pending = tips;
+    vector<string> missing;
+    while (!pending.empty())
+    {
+        string commit = pending.back();
+        pending.pop_back();
+        if (!seen.insert(commit).second || covered.count(commit))
+            continue;
+        if (existing.count(commit) == 0)
+            missing.push_back(commit);
+        for (const auto &parent : get_commit_parents(readObject(commit)))
+            pending.push_back(parent);
+    }
+
+    vector<string> lines(missing.size());
+    parallelFor(missing.size(), [&](size_t i)
+                {
+        if (chrono::steady_clock::now() < deadline)
+            lines[i] = buildBloomLine(missing[i]); });
+    string content;
+    size_t computed = 0;
+    for (const auto &line : lines)
+    {
+        content += line;
+        computed += !line.empty();
+    }
+    bool ok = appendBloomLines(content);
+
+    if (ok && computed == missing.size())
+    {
+        string tipList;
+        for (const auto &tip : tips)
+            tipList += tip + "\n";
+        string coveredPath = commonPath("info/commit-bloom-covered");
+        writeFile(coveredPath + ".tmp", tipList);
+        fs::rename(coveredPath + ".tmp", coveredPath);
+    }
+    cout << "Computed changed-path filters for " << computed << " of " << missing.size() << " commits.\n";
+}
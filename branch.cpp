@@ -13,12 +13,13 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include "helpers.hpp"
 
 using namespace std;
 
 void create_branch(const string &branch_name)
 {
-    string new_branch_path = ".minigit/refs/heads/" + branch_name;
+    string new_branch_path = commonPath("refs/heads/" + branch_name);
 
     // Check if the branch already exists
     ifstream check_existing_branch(new_branch_path);
@@ -29,7 +30,7 @@ void create_branch(const string &branch_name)
     }
 
     // Read HEAD to get current branch reference
-    ifstream head_file(".minigit/HEAD");
+    ifstream head_file(gitPath("HEAD"));
     if (!head_file)
     {
         cerr << "fatal: HEAD not found.\n";
@@ -44,7 +45,7 @@ void create_branch(const string &branch_name)
         return;
     }
 
-    string current_branch_ref_path = ".minigit/" + head_ref_line.substr(5); // remove "ref: "
+    string current_branch_ref_path = commonPath(head_ref_line.substr(5)); // remove "ref: "
 
     // Read commit hash from current branch reference
     ifstream current_branch_file(current_branch_ref_path);
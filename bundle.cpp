@@ -0,0 +1,349 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <unistd.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// A bundle is one gzip stream:
+//   # minigit bundle v1
+//   -<commit>            prerequisite the receiver must already have
+//   <commit> <ref>       ref carried by the bundle
+//   (blank line)
+//   <hash> <size>\n<size bytes of object data>   repeated for every object
+const string BUNDLE_SIGNATURE = "# minigit bundle v1";
+const size_t BUNDLE_CHUNK = 1 << 16;
+const size_t BUNDLE_VERIFY_BATCH = 256;
+
+// SHA-1 of a file's contents, read in chunks; empty if it cannot be read
+static string hashFile(const string &path)
+{
+    ifstream file(path, ios::binary);
+    if (!file)
+        return "";
+    EVP_MD_CTX *sha = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(sha, EVP_sha1(), nullptr);
+    vector<char> buffer(BUNDLE_CHUNK);
+    while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+        EVP_DigestUpdate(sha, buffer.data(), file.gcount());
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    EVP_DigestFinal_ex(sha, digest, &digestLength);
+    EVP_MD_CTX_free(sha);
+    string hex;
+    char byte[3];
+    for (unsigned int i = 0; i < digestLength; ++i)
+    {
+        snprintf(byte, sizeof(byte), "%02x", digest[i]);
+        hex += byte;
+    }
+    return hex;
+}
+
+static bool gzWriteAll(gzFile out, const char *data, size_t size)
+{
+    return size == 0 || gzwrite(out, data, size) == (int)size;
+}
+
+static string gzReadLine(gzFile in)
+{
+    char buffer[4096];
+    if (!gzgets(in, buffer, sizeof(buffer)))
+        return "";
+    string line(buffer);
+    if (!line.empty() && line.back() == '\n')
+        line.pop_back();
+    return line;
+}
+
+// Copies one object into the bundle in fixed-size chunks
+static bool bundleObject(gzFile out, const string &hash)
+{
+    ObjectLocation location;
+    ifstream object;
+    if (locateObject(hash, location))
+        object.open(location.path, ios::binary);
+    if (!object)
+    {
+        cerr << "Error: missing object " << hash << "\n";
+        return false;
+    }
+    object.seekg(location.offset);
+    size_t size = location.size;
+
+    string header = hash + " " + to_string(size) + "\n";
+    if (!gzWriteAll(out, header.data(), header.size()))
+        return false;
+    vector<char> buffer(BUNDLE_CHUNK);
+    while (size > 0)
+    {
+        size_t n = min(size, buffer.size());
+        if (!object.read(buffer.data(), n) || !gzWriteAll(out, buffer.data(), n))
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the history of a ref into a single compressed bundle file.
+ *
+ * Only objects reachable from the ref and not from the base are included, so a
+ * bundle can carry just the commits the receiver is missing. Objects are streamed
+ * in chunks, so memory use does not depend on object or bundle size.
+ *
+ * @param bundleFile The file to write.
+ * @param ref Branch name or commit to export.
+ * @param base Optional branch or commit (with or without a leading '^') the receiver already has.
+ */
+void bundleCreate(const string &bundleFile, const string &ref, const string &base)
+{
+    string tip = resolveCommitish(ref);
+    if (tip.empty())
+    {
+        cerr << "Error: No such branch or commit: " << ref << "\n";
+        return;
+    }
+    string baseRef = (!base.empty() && base[0] == '^') ? base.substr(1) : base;
+    string baseCommit;
+    if (!baseRef.empty())
+    {
+        baseCommit = resolveCommitish(baseRef);
+        if (baseCommit.empty())
+        {
+            cerr << "Error: No such branch or commit: " << baseRef << "\n";
+            return;
+        }
+    }
+
+    // The receiver has base's history and, like git's boundary objects, the trees
+    // and blobs of base itself; older trees are not worth reading to exclude
+    ReachableSet excluded;
+    if (!baseCommit.empty())
+    {
+        excluded = markReachable({baseCommit}, true);
+        string baseTree = treeHashOf(baseCommit);
+        excluded.trees.insert(baseTree);
+        for (const auto &[_, blobHash] : parseTreeObject(readObject(baseTree)))
+            excluded.blobs.insert(blobHash);
+    }
+    // The walk stops at base's commits, so only the new history's trees are read
+    ReachableSet wanted = markReachable({tip}, false, excluded.commits);
+
+    vector<string> objects;
+    for (const auto *set : {&wanted.commits, &wanted.trees, &wanted.blobs})
+    {
+        for (const auto &hash : *set)
+        {
+            if (!excluded.commits.count(hash) && !excluded.trees.count(hash) && !excluded.blobs.count(hash))
+                objects.push_back(hash);
+        }
+    }
+
+    gzFile out = gzopen(bundleFile.c_str(), "wb");
+    if (!out)
+    {
+        cerr << "Error: Could not create bundle file: " << bundleFile << "\n";
+        return;
+    }
+
+    string refName = fileExists(commonPath("refs/heads/" + ref)) ? "refs/heads/" + ref : "HEAD";
+    stringstream header;
+    header << BUNDLE_SIGNATURE << "\n";
+    if (!baseCommit.empty())
+        header << "-" << baseCommit << "\n";
+    header << tip << " " << refName << "\n\n";
+    string headerStr = header.str();
+
+    bool ok = gzWriteAll(out, headerStr.data(), headerStr.size());
+    for (size_t i = 0; ok && i < objects.size(); ++i)
+        ok = bundleObject(out, objects[i]);
+    if (gzclose(out) != Z_OK || !ok)
+    {
+        cerr << "Error: Failed to write bundle " << bundleFile << "\n";
+        fs::remove(bundleFile);
+        return;
+    }
+    cout << "Bundled " << objects.size() << " objects for " << refName << " into " << bundleFile << "\n";
+}
+
+/**
+ * @brief Imports the objects and refs of a bundle created by bundleCreate.
+ *
+ * Objects are streamed to temporary files, then hashed in parallel batches and
+ * only renamed into the object store if the hash matches. The bundle's branch is created, or
+ * fast-forwarded when the current tip is one of the bundle's prerequisites. A
+ * branch checked out in any worktree is never moved.
+ *
+ * @param bundleFile The bundle to read.
+ */
+void bundleUnbundle(const string &bundleFile)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    gzFile in = gzopen(bundleFile.c_str(), "rb");
+    if (!in)
+    {
+        cerr << "Error: Could not open bundle: " << bundleFile << "\n";
+        return;
+    }
+    gzbuffer(in, BUNDLE_CHUNK);
+    if (gzReadLine(in) != BUNDLE_SIGNATURE)
+    {
+        cerr << "Error: " << bundleFile << " is not a MiniGit bundle.\n";
+        gzclose(in);
+        return;
+    }
+
+    vector<string> prerequisites;
+    vector<pair<string, string>> refs; // commit, ref name
+    for (string line = gzReadLine(in); !line.empty(); line = gzReadLine(in))
+    {
+        if (line[0] == '-')
+            prerequisites.push_back(line.substr(1));
+        else if (line.find(' ') != string::npos)
+            refs.emplace_back(line.substr(0, line.find(' ')), line.substr(line.find(' ') + 1));
+    }
+    for (const auto &commit : prerequisites)
+    {
+        if (!objectExists(commit))
+        {
+            cerr << "Error: Repository lacks prerequisite commit " << commit << "\n";
+            gzclose(in);
+            return;
+        }
+    }
+
+    // Inflating is sequential, so objects are streamed to temporary files one after
+    // another and each batch of them is then hashed and moved into place in parallel
+    size_t imported = 0, skipped = 0;
+    bool ok = true;
+    vector<char> buffer(BUNDLE_CHUNK);
+    vector<string> batch; // hashes written to temporary files and not yet verified
+    auto tempPathOf = [](const string &hash)
+    { return commonPath("objects/" + hash) + "." + to_string(getpid()) + ".tmp"; };
+    auto verifyBatch = [&]()
+    {
+        enum Outcome : char { Corrupt, Imported, Skipped };
+        vector<char> outcomes(batch.size());
+        parallelFor(batch.size(), [&](size_t i)
+                    {
+            string tempPath = tempPathOf(batch[i]);
+            if (hashFile(tempPath) != batch[i])
+            {
+                outcomes[i] = Corrupt;
+                fs::remove(tempPath);
+            }
+            else if (objectExists(batch[i]))
+            {
+                outcomes[i] = Skipped;
+                fs::remove(tempPath);
+            }
+            else
+            {
+                outcomes[i] = Imported;
+                fs::rename(tempPath, commonPath("objects/" + batch[i]));
+            } });
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            if (outcomes[i] == Corrupt)
+            {
+                cerr << "Error: corrupt object " << batch[i] << " in bundle\n";
+                ok = false;
+            }
+            imported += outcomes[i] == Imported;
+            skipped += outcomes[i] == Skipped;
+        }
+        batch.clear();
+    };
+
+    for (string line = gzReadLine(in); ok && !line.empty(); line = gzReadLine(in))
+    {
+        istringstream iss(line);
+        string hash;
+        size_t size = 0;
+        iss >> hash >> size;
+        if (hash.size() != 40 || hash.find_first_not_of("0123456789abcdef") != string::npos)
+        {
+            cerr << "Error: malformed object header in bundle: " << line << "\n";
+            ok = false;
+            break;
+        }
+
+        string tempPath = tempPathOf(hash);
+        ofstream out(tempPath, ios::binary);
+        while (size > 0)
+        {
+            int n = gzread(in, buffer.data(), min(size, buffer.size()));
+            if (n <= 0)
+                break;
+            out.write(buffer.data(), n);
+            size -= n;
+        }
+        out.close();
+        if (size > 0 || !out)
+        {
+            cerr << "Error: truncated object " << hash << " in bundle\n";
+            fs::remove(tempPath);
+            ok = false;
+            break;
+        }
+        batch.push_back(hash);
+        if (batch.size() == BUNDLE_VERIFY_BATCH)
+            verifyBatch();
+    }
+    if (ok)
+        verifyBatch();
+    for (const auto &hash : batch)
+        fs::remove(tempPathOf(hash)); // left over when reading failed
+    gzclose(in);
+
+    if (!ok)
+    {
+        cerr << "Unbundle aborted; refs were not updated.\n";
+        return;
+    }
+
+    for (const auto &[commit, refName] : refs)
+    {
+        if (refName.rfind("refs/heads/", 0) != 0)
+        {
+            cout << commit << " " << refName << "\n";
+            continue;
+        }
+        string current = trim(readFile(commonPath(refName)));
+        if (current == commit)
+            continue;
+        // Moving a checked-out branch would leave its working tree and index behind
+        auto worktrees = worktreeGitDirs();
+        if (any_of(worktrees.begin(), worktrees.end(), [&](const string &dir)
+                   { return trim(readFile(dir + "/HEAD")) == "ref: " + refName; }))
+        {
+            cerr << "Warning: not updating " << refName << ", which is checked out; bundle has " << commit << "\n";
+            continue;
+        }
+        bool fastForward = current.empty() ||
+                           find(prerequisites.begin(), prerequisites.end(), current) != prerequisites.end();
+        if (!fastForward)
+        {
+            cerr << "Warning: not updating " << refName << " (" << current << "), bundle has " << commit << "\n";
+            continue;
+        }
+        writeFile(commonPath(refName), commit);
+        cout << "Updated " << refName << " to " << commit << "\n";
+    }
+    cout << "Unbundled " << imported << " objects (" << skipped << " already present)\n";
+}
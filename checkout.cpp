@@ -5,6 +5,7 @@
 #include <filesystem>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 #include <openssl/sha.h>
 #include "helpers.hpp"
 
@@ -13,29 +14,66 @@ namespace fs = std::filesystem;
 
 // Utility functions
 
+// A forced checkout also discards local edits to paths the two trees agree on:
+// every target path whose working copy differs from its blob is rewritten
+static void restoreLocalEdits(const string &treeHash, const function<bool(const string &)> &inSparse, size_t batchSize)
+{
+    TreeDiffIterator target({treeHash, ""}, memoryBudget());
+    vector<TreeEntryDiff> batch;
+    auto restore = [&]()
+    {
+        vector<char> edited(batch.size());
+        parallelFor(batch.size(), [&](size_t i)
+                    { edited[i] = !fileMatchesObject(batch[i].path, batch[i].hashes.back()); });
+        vector<TreeEntryDiff> changes;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            if (edited[i])
+                changes.push_back(move(batch[i]));
+        }
+        updateWorkingTree(changes);
+        batch.clear();
+    };
+    for (TreeEntryDiff entry; target.next(entry);)
+    {
+        if (!inSparse(entry.path))
+            continue;
+        batch.push_back({entry.path, {"", entry.hashes[0]}});
+        if (batch.size() == batchSize)
+            restore();
+    }
+    if (!batch.empty())
+        restore();
+}
+
 void checkout(const string &ref, bool force = false)
 {
     string commitHash;
-    string refPath = ".minigit/refs/heads/" + ref;
+    string refPath = commonPath("refs/heads/" + ref);
     bool isBranch = false;
 
     // Resolve ref
     if (fileExists(refPath))
     {
-        string hd = readFile(".minigit/HEAD");
+        string hd = trim(readFile(gitPath("HEAD")));
         if (hd == "ref: refs/heads/" + ref)
         {
             cout << "Already on branch " << ref << "\n";
             return;
         }
+        for (const auto &dir : worktreeGitDirs())
+        {
+            if (dir != gitDir() && trim(readFile(dir + "/HEAD")) == "ref: refs/heads/" + ref)
+            {
+                cerr << "Error: Branch " << ref << " is already checked out in another worktree.\n";
+                return;
+            }
+        }
         commitHash = trim(readFile(refPath));
         isBranch = true;
     }
-    else if (fileExists(".minigit/objects/" + ref))
-    {
-        commitHash = ref;
-        cout << "Note: You are now in a detached HEAD state at commit " << ref << ".\n";
-    }
+    else if (!(commitHash = resolveCommitish(ref)).empty())
+        cout << "Note: You are now in a detached HEAD state at commit " << commitHash << ".\n";
     else
     {
         cerr << "Error: No such branch or commit: " << ref << "\n";
@@ -43,22 +81,56 @@ void checkout(const string &ref, bool force = false)
     }
 
     // Get tree of target commit
-    string commitContent = readFile(".minigit/objects/" + commitHash);
+    string commitContent = readObject(commitHash);
     string treeHash = getTreeHashFromCommit(commitContent);
     if (treeHash.empty())
     {
         cerr << "Invalid commit: tree not found.\n";
         return;
     }
-    string treeContent = readFile(".minigit/objects/" + treeHash);
-    map<string, string> targetTrackedFiles = parseTreeObject(treeContent); // filename -> blobHash
 
-    map<string, string> currentTrackedFiles = getCurrentTrackedFiles();
+    // Only the paths that differ between the two trees are checked and written;
+    // paths outside the sparse checkout are never read or written. The trees are
+    // diffed twice, checking and then writing a batch at a time, so memory stays
+    // bounded by the batch size and the memory budget rather than the tree size.
+    const size_t batchSize = 4096;
+    function<bool(const string &)> inSparse = sparseMatcher();
+    vector<string> trees = {treeHashOf(resolveCommitish("HEAD")), treeHash};
+    auto forEachBatch = [&](const function<void(const vector<TreeEntryDiff> &)> &fn)
+    {
+        TreeDiffIterator diff(trees, memoryBudget());
+        vector<TreeEntryDiff> batch;
+        for (TreeEntryDiff change; diff.next(change);)
+        {
+            if (!inSparse(change.path))
+                continue;
+            batch.push_back(change);
+            if (batch.size() == batchSize)
+            {
+                fn(batch);
+                batch.clear();
+            }
+        }
+        if (!batch.empty())
+            fn(batch);
+    };
 
-    // Check modified tracked files
     if (!force)
     {
-        vector<string> modifiedFiles = getModifiedFiles(currentTrackedFiles);
+        vector<string> modifiedFiles, conflicts;
+        forEachBatch([&](const vector<TreeEntryDiff> &batch)
+                     {
+            // Modified tracked files, and untracked files that would be overwritten
+            map<string, string> changedTracked;
+            for (const auto &change : batch)
+            {
+                if (!change.hashes[0].empty())
+                    changedTracked.emplace_hint(changedTracked.end(), change.path, change.hashes[0]);
+                else if (fileExists(change.path))
+                    conflicts.push_back(change.path);
+            }
+            for (auto &file : getModifiedFiles(changedTracked))
+                modifiedFiles.push_back(move(file)); });
         if (!modifiedFiles.empty())
         {
             cerr << "Error: Cannot checkout due to modified tracked files:\n";
@@ -67,19 +139,6 @@ void checkout(const string &ref, bool force = false)
             cerr << "Commit, stash or use --force to proceed.\n";
             return;
         }
-    }
-
-    // Check untracked files that would be overwritten
-    if (!force)
-    {
-        vector<string> conflicts;
-        for (const auto &[filename, _] : targetTrackedFiles)
-        {
-            if (fileExists(filename) && currentTrackedFiles.count(filename) == 0)
-            {
-                conflicts.push_back(filename);
-            }
-        }
         if (!conflicts.empty())
         {
             cerr << "Error: The following untracked files would be overwritten by checkout:\n";
@@ -90,25 +149,36 @@ void checkout(const string &ref, bool force = false)
         }
     }
 
-    // Remove files from current tree not in new tree
-    try
+    // A partial repository fetches every missing blob the checkout writes in one batch
+    if (!promisorRemote().empty())
     {
-        for (const auto &[filename, _] : currentTrackedFiles)
+        vector<string> missing;
+        forEachBatch([&](const vector<TreeEntryDiff> &batch)
+                     {
+            for (const auto &change : batch)
+            {
+                if (!change.hashes.back().empty() && !objectExists(change.hashes.back()))
+                    missing.push_back(change.hashes.back());
+            } });
+        if (fetchPromisedObjects(missing) < missing.size())
         {
-            if (targetTrackedFiles.count(filename) == 0)
+            size_t unavailable = count_if(missing.begin(), missing.end(), [](const string &hash)
+                                          { return !objectExists(hash); });
+            if (unavailable > 0)
             {
-                fs::remove(filename);
-                cout << "Removed: " << filename << "\n";
+                cerr << "Error: Cannot checkout: " << unavailable << " blobs could not be fetched from "
+                     << promisorRemote() << "\n";
+                return;
             }
         }
+    }
 
-        // Write files from new tree
-        for (const auto &[filename, blobHash] : targetTrackedFiles)
-        {
-            string blobContent = readFile(".minigit/objects/" + blobHash);
-            writeFile(filename, blobContent);
-            cout << "Updated: " << filename << "\n";
-        }
+    try
+    {
+        forEachBatch([](const vector<TreeEntryDiff> &batch)
+                     { updateWorkingTree(batch); });
+        if (force)
+            restoreLocalEdits(treeHash, inSparse, batchSize);
     }
     catch (const runtime_error &e)
     {
@@ -118,9 +188,10 @@ void checkout(const string &ref, bool force = false)
 
     // Update HEAD
     if (isBranch)
-        writeFile(".minigit/HEAD", "ref: refs/heads/" + ref);
+        writeFile(gitPath("HEAD"), "ref: refs/heads/" + ref);
     else
-        writeFile(".minigit/HEAD", commitHash);
+        writeFile(gitPath("HEAD"), commitHash);
 
     cout << "Switched to " << (isBranch ? "branch " : "commit ") << ref << " successfully.\n";
+    reportPeakMemory("checkout");
 }
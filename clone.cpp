@@ -0,0 +1,216 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// The shared .minigit directory of the repository at or containing a working tree
+static fs::path sourceCommonDir(const fs::path &source)
+{
+    fs::path gitDir = source / ".minigit";
+    if (fs::is_regular_file(gitDir))
+    {
+        string link = trim(readFile(gitDir.string()));
+        if (link.rfind("gitdir: ", 0) != 0)
+            return {};
+        gitDir = trim(link.substr(8));
+        string common = trim(readFile((gitDir / "commondir").string()));
+        if (!common.empty())
+            gitDir = common;
+    }
+    return fs::is_directory(gitDir) ? fs::absolute(gitDir).lexically_normal() : fs::path();
+}
+
+// Copies the commits and trees reachable from the source's branches into the
+// clone, leaving its blobs behind; returns the number of objects copied
+static size_t copyCommitsAndTrees(const fs::path &srcGit, const fs::path &dstGit)
+{
+    vector<string> stores = {(srcGit / "objects").string()};
+    for (auto &line : splitLines(readFile((srcGit / "objects" / "info" / "alternates").string())))
+    {
+        if (!trim(line).empty() && line[0] != '#')
+            stores.push_back(trim(line));
+    }
+    auto copyObject = [&](const string &hash, string &content)
+    {
+        ObjectLocation location;
+        for (const auto &store : stores)
+        {
+            if (locateObjectIn(store, hash, location))
+            {
+                content = readObjectFrom(store, hash);
+                writeFile((dstGit / "objects" / hash).string(), content);
+                return;
+            }
+        }
+        throw runtime_error("source is missing object " + hash);
+    };
+
+    vector<string> frontier;
+    for (const auto &entry : fs::recursive_directory_iterator(srcGit / "refs" / "heads"))
+    {
+        if (entry.is_regular_file())
+            frontier.push_back(trim(readFile(entry.path().string())));
+    }
+    unordered_set<string> seen(frontier.begin(), frontier.end());
+    string commit, tree;
+    while (!frontier.empty())
+    {
+        string hash = frontier.back();
+        frontier.pop_back();
+        copyObject(hash, commit);
+        string treeHash = getTreeHashFromCommit(commit);
+        if (!treeHash.empty() && seen.insert(treeHash).second)
+            copyObject(treeHash, tree);
+        for (const auto &parent : get_commit_parents(commit))
+        {
+            if (seen.insert(parent).second)
+                frontier.push_back(parent);
+        }
+    }
+    return seen.size();
+}
+
+/**
+ * @brief Clones a repository on the local filesystem.
+ *
+ * Objects are immutable, so instead of being copied they are hardlinked into the
+ * new repository (falling back to a copy across filesystems). With shared, no
+ * objects are linked at all: the new repository lists the source's object store
+ * in objects/info/alternates and reads from it. Refs, HEAD and config are copied,
+ * and HEAD is then checked out with batched parallel writes.
+ *
+ * A blobless clone copies only commits and trees and records the source as its
+ * promisor remote; blobs are fetched from it in batches as they are first needed,
+ * starting with those HEAD's checkout writes.
+ *
+ * @param source Working tree of the repository to clone.
+ * @param destination Directory to create; must not exist or be empty.
+ * @param shared Reference the source objects through alternates instead of linking.
+ * @param blobless Make a partial clone without blobs.
+ */
+void cloneRepo(const string &source, const string &destination, bool shared, bool blobless)
+{
+    auto start = chrono::steady_clock::now();
+    fs::path srcGit = sourceCommonDir(source);
+    if (srcGit.empty())
+    {
+        cerr << "fatal: '" << source << "' is not a MiniGit repository.\n";
+        return;
+    }
+    if (shared && blobless)
+    {
+        cerr << "fatal: a shared clone already reads every object from the source; it cannot also be blobless.\n";
+        return;
+    }
+    if (fs::exists(destination) && !fs::is_empty(destination))
+    {
+        cerr << "fatal: destination path '" << destination << "' already exists and is not empty.\n";
+        return;
+    }
+
+    fs::path dstRoot = fs::absolute(destination).lexically_normal();
+    fs::path dstGit = dstRoot / ".minigit";
+    size_t linked = 0, copied = 0;
+    try
+    {
+        fs::create_directories(dstGit / "objects" / "info");
+        fs::create_directories(dstGit / "refs" / "heads");
+
+        // Alternates of the source stay valid for the clone
+        string alternates = readFile((srcGit / "objects" / "info" / "alternates").string());
+        if (shared)
+            alternates += (srcGit / "objects").string() + "\n";
+        if (!alternates.empty())
+            writeFile((dstGit / "objects" / "info" / "alternates").string(), alternates);
+
+        if (blobless)
+            copied = copyCommitsAndTrees(srcGit, dstGit);
+        else if (!shared)
+        {
+            // Loose objects and packs are never modified once written, so both can be shared
+            vector<fs::path> objects;
+            for (const auto &entry : fs::directory_iterator(srcGit / "objects"))
+            {
+                if (entry.is_regular_file())
+                    objects.push_back(entry.path());
+            }
+            error_code packEc;
+            for (const auto &entry : fs::directory_iterator(srcGit / "objects" / "pack", packEc))
+            {
+                if (entry.is_regular_file() && entry.path().filename().string().rfind("pack-", 0) == 0)
+                    objects.push_back(entry.path());
+            }
+            fs::create_directories(dstGit / "objects" / "pack");
+            atomic<size_t> linkCount{0}, copyCount{0};
+            atomic<bool> failed{false};
+            parallelFor(objects.size(), [&](size_t i)
+                        {
+                fs::path target = dstGit / "objects" / objects[i].lexically_relative(srcGit / "objects");
+                error_code ec;
+                fs::create_hard_link(objects[i], target, ec);
+                if (!ec)
+                {
+                    linkCount++;
+                    return;
+                }
+                if (fs::copy_file(objects[i], target, fs::copy_options::overwrite_existing, ec))
+                    copyCount++;
+                else
+                    failed = true; });
+            if (failed)
+                throw runtime_error("could not link or copy objects");
+            linked = linkCount;
+            copied = copyCount;
+        }
+
+        fs::copy(srcGit / "refs" / "heads", dstGit / "refs" / "heads", fs::copy_options::recursive | fs::copy_options::overwrite_existing);
+        fs::copy_file(srcGit / "HEAD", dstGit / "HEAD");
+        if (fs::exists(srcGit / "config"))
+            fs::copy_file(srcGit / "config", dstGit / "config");
+        writeFile((dstGit / "index").string(), "");
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error cloning repository: " << e.what() << "\n";
+        return;
+    }
+
+    // Check out HEAD from inside the new repository
+    fs::path previous = fs::current_path();
+    fs::current_path(dstRoot);
+    resetRepoPaths();
+    try
+    {
+        // Sparse patterns are per working tree and are not cloned
+        if (get_config_value("sparseCheckout") == "true")
+            set_config_value("sparseCheckout", "false");
+        if (blobless)
+            set_config_value("promisorRemote", (srcGit / "objects").string());
+        updateWorkingTree({}, getCurrentTrackedFiles());
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error checking out HEAD: " << e.what() << "\n";
+    }
+    fs::current_path(previous);
+    resetRepoPaths();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Cloned into '" << destination << "': ";
+    if (shared)
+        cout << "objects shared through alternates";
+    else if (blobless)
+        cout << copied << " commits and trees copied, blobs fetched on demand";
+    else
+        cout << linked << " objects hardlinked, " << copied << " copied";
+    cout << " (" << seconds << "s)\n";
+}
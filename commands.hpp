@@ -1,11 +1,55 @@
+#pragma once
 #include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
 
 using namespace std;
+
+struct LogOptions
+{
+    string revision = "HEAD";
+    size_t maxCount = 0; // 0 means no limit
+    string since;        // "YYYY-MM-DD[ HH:MM:SS]"; commits older than this are not shown
+    string until;        // commits newer than this are not shown
+    bool oneline = false;
+    string format; // placeholders: %H %h %P %p %an %ad %s %n
+    size_t abbrev = 7; // minimum length of %h and %p; longer where needed to stay unique
+    bool topoOrder = false;
+    bool stat = false;    // per-file change graph and totals after each commit
+    bool numstat = false; // "added<TAB>deleted<TAB>path" lines after each commit
+    string path;
+};
 void stageFile(const string &filePath);
 void create_branch(const string &branch_name);
 void createCommit(const string &commitMessage);
-void printCommitLog();
+void printCommitLog(const string &path = "");
+void printCommitLog(const LogOptions &options);
 void initMiniGit();
 void checkout(const string &ref, bool force = false);
 void merge(const string &target_branch);
-void diffCommits(const string &commitHash1, const string &commitHash2);
\ No newline at end of file
+void diffCommits(const string &commitRef1, const string &commitRef2);
+void garbageCollect(long long gracePeriodSeconds = 14 * 24 * 60 * 60,
+                    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max());
+void fsck();
+void sparseCheckoutSet(const vector<string> &patterns, bool cone);
+void sparseCheckoutDisable();
+void updateCommitBlooms(chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max());
+void stageFiles(const vector<string> &filePaths);
+void mergeTree(const string &our_ref, const string &their_ref);
+void worktreeAdd(const string &directory, const string &branch_name);
+void worktreeList();
+void cloneRepo(const string &source, const string &destination, bool shared = false, bool blobless = false);
+void bundleCreate(const string &bundleFile, const string &ref, const string &base = "");
+void bundleUnbundle(const string &bundleFile);
+void cherryPick(const string &commitRef);
+void rebaseOnto(const string &newBase, const string &upstream);
+void status();
+void maintenanceRun(const vector<string> &tasks, long long timeBudgetSeconds = 300, uintmax_t ioBudgetBytes = 256 * 1024 * 1024);
+void maintenanceStart(long long intervalSeconds = 3600);
+void maintenanceStop();
+void grepCommit(const string &pattern, const string &commitRef = "HEAD");
+void archiveCommit(const string &commitRef, const string &outputFile = "");
+void blameFile(const string &path);
+void serveObjects(const string &socketPath);
+void benchmarkBatchIo(size_t fileCount = 100000);
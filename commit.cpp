@@ -16,15 +16,18 @@ using namespace std;
 
 void createCommit(const string &message)
 {
-    string head = ".minigit/HEAD";
+    string head = gitPath("HEAD");
     string cont = readFile(head);
 
     cont = get_current_commit();
     string treeContent = generate_tree(cont);
     string treeHash = generateHash(treeContent);
 
-    ofstream treeFile(".minigit/objects/" + treeHash);
-    treeFile << treeContent;
+    if (!objectExists(treeHash))
+    {
+        ofstream treeFile(objectPath(treeHash));
+        treeFile << treeContent;
+    }
 
     string parent = get_current_commit();
     string timestamp = get_timestamp();
@@ -42,15 +45,23 @@ void createCommit(const string &message)
     string commitStr = commitContent.str();
     string commitHash = generateHash(commitStr);
 
-    ofstream commitFile(".minigit/objects/" + commitHash);
+    ofstream commitFile(objectPath(commitHash));
     commitFile << commitStr;
+    commitFile.close();
+    writeCommitBloom(commitHash);
 
     // 3. Update current branch
     update_current_branch(commitHash);
 
     // 4. Clear index
-    ofstream clearIndex(".minigit/index");
-    clearIndex.close();
+    try
+    {
+        clearIndex();
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Error: " << e.what() << "\n";
+    }
 
     cout << "Committed as " << commitHash << "\n";
 }
@@ -2,60 +2,167 @@
 #include <fstream>
 #include <string>
 #include <map>
-#include <set>
 #include <filesystem>
 #include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 #include "helpers.hpp"
 
 using namespace std;
 
-// Compare two commits
-void diffCommits(const string &commitHash1, const string &commitHash2)
+// Splits content into lines without their newlines; a final line without one is kept
+vector<string> splitLines(const string &content)
 {
-    string commit1 = readFile(".minigit/objects/" + commitHash1);
-    string commit2 = readFile(".minigit/objects/" + commitHash2);
-
-    string treeHash1 = getTreeHashFromCommit(commit1);
-    string treeHash2 = getTreeHashFromCommit(commit2);
-
-    if (treeHash1.empty() || treeHash2.empty())
+    vector<string> lines;
+    size_t start = 0;
+    while (start < content.size())
     {
-        cerr << "Error: One or both commits missing tree.\n";
-        return;
+        size_t end = content.find('\n', start);
+        if (end == string::npos)
+            end = content.size();
+        lines.push_back(content.substr(start, end - start));
+        start = end + 1;
     }
+    return lines;
+}
 
-    map<string, string> tree1 = parseTreeObject(readFile(".minigit/objects/" + treeHash1));
-    map<string, string> tree2 = parseTreeObject(readFile(".minigit/objects/" + treeHash2));
-
-    set<string> allFiles;
-    for (auto &[file, _] : tree1)
-        allFiles.insert(file);
-    for (auto &[file, _] : tree2)
-        allFiles.insert(file);
+/**
+ * @brief Computes a shortest line diff between two versions (Myers' algorithm).
+ *
+ * Lines are interned to integers first so the search only compares ints, and the
+ * common prefix and suffix are matched up front. Only the part of each round's
+ * frontier that can be reached is kept for the backtrack, so memory grows with
+ * the square of the number of edits rather than with file size.
+ *
+ * @return For every line of newLines, the index of the line of oldLines it was
+ * kept from, or -1 if it was added.
+ */
+vector<int> diffLines(const vector<string> &oldLines, const vector<string> &newLines)
+{
+    unordered_map<string, int> ids;
+    vector<int> a(oldLines.size()), b(newLines.size());
+    for (size_t i = 0; i < oldLines.size(); ++i)
+        a[i] = ids.emplace(oldLines[i], ids.size()).first->second;
+    for (size_t j = 0; j < newLines.size(); ++j)
+        b[j] = ids.emplace(newLines[j], ids.size()).first->second;
 
-    for (const string &filename : allFiles)
+    vector<int> matches(b.size(), -1);
+    int n = a.size(), m = b.size();
+    int prefix = 0;
+    while (prefix < n && prefix < m && a[prefix] == b[prefix])
     {
-        int in1 = tree1.count(filename);
-        int in2 = tree2.count(filename);
+        matches[prefix] = prefix;
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && a[n - 1 - suffix] == b[m - 1 - suffix])
+    {
+        matches[m - 1 - suffix] = n - 1 - suffix;
+        suffix++;
+    }
 
-        if (in1 >= 1 && in2 >= 1)
+    // Myers on the middle section; x indexes a, y indexes b, k = x - y
+    int lo = prefix, n2 = n - prefix - suffix, m2 = m - prefix - suffix;
+    int maxD = n2 + m2;
+    vector<vector<int>> trace; // trace[d][k + d] = furthest x on diagonal k after d edits
+    vector<int> v(2 * maxD + 3, 0);
+    int offset = maxD + 1;
+    int finalD = 0;
+    for (int d = 0; d <= maxD; ++d)
+    {
+        bool done = false;
+        for (int k = -d; k <= d; k += 2)
         {
-            if (trim(tree1[filename]) == trim(tree2[filename]))
-            {
-                cout << "UNCHANGED: " << filename << '\n';
-            }
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                x = v[offset + k + 1];
             else
+                x = v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n2 && y < m2 && a[lo + x] == b[lo + y])
             {
-                cout << "MODIFIED:  " << filename << '\n';
+                x++;
+                y++;
             }
+            v[offset + k] = x;
+            if (x >= n2 && y >= m2)
+                done = true;
         }
-        else if (in1 >= 1 && in2 == 0)
+        trace.emplace_back(v.begin() + offset - d, v.begin() + offset + d + 1);
+        if (done)
+        {
+            finalD = d;
+            break;
+        }
+    }
+
+    int x = n2, y = m2;
+    for (int d = finalD; d > 0; --d)
+    {
+        const vector<int> &prev = trace[d - 1]; // diagonals -(d-1)..(d-1)
+        int k = x - y;
+        auto at = [&](int diagonal)
+        { return prev[diagonal + d - 1]; };
+        int prevK = (k == -d || (k != d && at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+        int prevX = at(prevK);
+        int prevY = prevX - prevK;
+        while (x > prevX && y > prevY)
         {
-            cout << "REMOVED:   " << filename << '\n';
+            x--;
+            y--;
+            matches[lo + y] = lo + x;
         }
-        else if (in1 == 0 && in2 >= 1)
+        x = prevX;
+        y = prevY;
+    }
+    while (x > 0 && y > 0)
+    {
+        x--;
+        y--;
+        matches[lo + y] = lo + x;
+    }
+    return matches;
+}
+
+// Compare two commits (branches, or full or abbreviated hashes), listing only the files that differ
+void diffCommits(const string &commitRef1, const string &commitRef2)
+{
+    string commitHash1 = resolveCommitish(commitRef1);
+    string commitHash2 = resolveCommitish(commitRef2);
+    if (commitHash1.empty() || commitHash2.empty())
+    {
+        cerr << "Error: No such commit: " << (commitHash1.empty() ? commitRef1 : commitRef2) << "\n";
+        return;
+    }
+    string commit1 = readObject(commitHash1);
+    string commit2 = readObject(commitHash2);
+
+    string treeHash1 = getTreeHashFromCommit(commit1);
+    string treeHash2 = getTreeHashFromCommit(commit2);
+
+    if (treeHash1.empty() || treeHash2.empty())
+    {
+        cerr << "Error: One or both commits missing tree.\n";
+        return;
+    }
+
+    TreeDiffIterator diff({treeHash1, treeHash2}, memoryBudget());
+    string out;
+    for (TreeEntryDiff entry; diff.next(entry);)
+    {
+        if (entry.hashes[0].empty())
+            out += "ADDED:     " + entry.path + '\n';
+        else if (entry.hashes[1].empty())
+            out += "REMOVED:   " + entry.path + '\n';
+        else
+            out += "MODIFIED:  " + entry.path + '\n';
+        if (out.size() >= 1 << 16)
         {
-            cout << "ADDED:     " << filename << '\n';
+            cout << out;
+            out.clear();
         }
     }
+    cout << out;
+    reportPeakMemory("diff");
 }
@@ -0,0 +1,288 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <filesystem>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Trees are parsed in groups of this size while the commit walk goes on, so a walk
+// that stops at its deadline has already marked the blobs of every commit it read
+const size_t TREE_PARSE_BATCH = 1024;
+
+// Marks every object reachable from the given commits. Each generation of the
+// commit walk and the tree parsing are fanned out with parallelFor. With
+// commitsOnly, only commits are marked and no tree is read. The walk does not enter
+// the commits in stopAt, nor anything only reachable through them. At the deadline
+// the walk stops and the commits it has not read yet are left in unwalked.
+ReachableSet markReachable(const vector<string> &tips, bool commitsOnly, const unordered_set<string> &stopAt,
+                           chrono::steady_clock::time_point deadline)
+{
+    ReachableSet reachable;
+    vector<string> frontier;
+    for (const auto &tip : tips)
+    {
+        if (!stopAt.count(tip) && reachable.commits.insert(tip).second)
+            frontier.push_back(tip);
+    }
+
+    vector<string> treeHashes;
+    auto parseTrees = [&]()
+    {
+        vector<vector<string>> blobs(treeHashes.size());
+        parallelFor(treeHashes.size(), [&](size_t i)
+                    {
+            for (const auto &[_, blobHash] : parseTreeObject(readObject(treeHashes[i])))
+                blobs[i].push_back(blobHash); });
+        for (const auto &list : blobs)
+            reachable.blobs.insert(list.begin(), list.end());
+        treeHashes.clear();
+    };
+
+    while (!frontier.empty())
+    {
+        if (chrono::steady_clock::now() >= deadline)
+        {
+            reachable.unwalked = move(frontier);
+            break;
+        }
+        vector<string> trees(frontier.size());
+        vector<vector<string>> parents(frontier.size());
+        parallelFor(frontier.size(), [&](size_t i)
+                    {
+            string content = readObject(frontier[i]);
+            trees[i] = getTreeHashFromCommit(content);
+            parents[i] = get_commit_parents(content); });
+
+        vector<string> next;
+        for (size_t i = 0; i < frontier.size(); ++i)
+        {
+            if (!commitsOnly && !trees[i].empty() && reachable.trees.insert(trees[i]).second)
+                treeHashes.push_back(trees[i]);
+            for (const auto &parent : parents[i])
+            {
+                if (!stopAt.count(parent) && reachable.commits.insert(parent).second)
+                    next.push_back(parent);
+            }
+        }
+        frontier.swap(next);
+        if (treeHashes.size() >= TREE_PARSE_BATCH)
+            parseTrees();
+    }
+    parseTrees();
+
+    return reachable;
+}
+
+/**
+ * @brief Reads what earlier loose-objects maintenance runs have packed.
+ *
+ * Stops are commits whose whole history (every ancestor, tree and blob) is packed,
+ * so walks for packing or pruning loose objects need not enter them. Pending are
+ * commits a walk cut short by its deadline had not read yet; the next walk starts
+ * from them as well as from the refs.
+ */
+PackedHistory readPackedHistory()
+{
+    PackedHistory history;
+    ifstream file(commonPath("maintenance-packed"));
+    string kind, hash;
+    while (file >> kind >> hash)
+    {
+        if (kind == "stop")
+            history.stops.insert(hash);
+        else if (kind == "pending")
+            history.pending.push_back(hash);
+    }
+    return history;
+}
+
+// Replaces the record of packed history; written aside and renamed into place
+void writePackedHistory(const PackedHistory &history)
+{
+    stringstream content;
+    for (const auto &hash : history.stops)
+        content << "stop " << hash << "\n";
+    for (const auto &hash : history.pending)
+        content << "pending " << hash << "\n";
+    string path = commonPath("maintenance-packed");
+    writeFile(path + ".tmp", content.str());
+    fs::rename(path + ".tmp", path);
+}
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Removes loose objects that cannot be reached from any ref.
+ *
+ * Everything reachable from the branches, a detached HEAD or an index is kept.
+ * Unreachable objects are only deleted once they are older than the grace period,
+ * so objects written by a concurrent add or commit are never pruned. If marking
+ * does not finish by the deadline, nothing is pruned.
+ *
+ * @param gracePeriodSeconds Minimum age of an unreachable object before it is deleted.
+ * @param deadline Pruning stops here; the remaining objects wait for the next run.
+ */
+void garbageCollect(long long gracePeriodSeconds, chrono::steady_clock::time_point deadline)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    // History that maintenance has packed in full holds no loose objects, so the
+    // mark skips it and resumes where an interrupted loose-objects walk stopped
+    auto start = chrono::steady_clock::now();
+    PackedHistory history = readPackedHistory();
+    vector<string> tips = getRefTips();
+    tips.insert(tips.end(), history.pending.begin(), history.pending.end());
+    ReachableSet reachable = markReachable(tips, false, history.stops, deadline);
+    if (!reachable.unwalked.empty())
+    {
+        // Anything not marked yet may still be reachable, so nothing can be pruned
+        cout << "Time budget reached after marking " << reachable.commits.size()
+             << " commits; nothing pruned this run\n";
+        return;
+    }
+
+    // Staged blobs of every worktree are not in any commit yet but must survive
+    for (const auto &dir : worktreeGitDirs())
+    {
+        for (const auto &[_, hash] : readIndexEntries(dir + "/index"))
+            reachable.blobs.insert(hash);
+    }
+    double markSeconds = secondsSince(start);
+
+    auto cutoff = fs::file_time_type::clock::now() - chrono::seconds(gracePeriodSeconds);
+    vector<string> objects = listObjects();
+    size_t pruned = 0, kept = 0, scanned = 0;
+    uintmax_t freedBytes = 0;
+    for (const auto &hash : objects)
+    {
+        if (chrono::steady_clock::now() >= deadline)
+            break;
+        scanned++;
+        if (reachable.commits.count(hash) || reachable.trees.count(hash) || reachable.blobs.count(hash))
+            continue;
+
+        string path = objectPath(hash);
+        error_code ec;
+        auto mtime = fs::last_write_time(path, ec);
+        if (ec || mtime > cutoff)
+        {
+            kept++;
+            continue;
+        }
+        uintmax_t size = fs::file_size(path, ec);
+        if (fs::remove(path, ec))
+        {
+            pruned++;
+            freedBytes += ec ? 0 : size;
+        }
+    }
+
+    double total = secondsSince(start);
+    size_t marked = reachable.commits.size() + reachable.trees.size() + reachable.blobs.size();
+    cout << "Marked " << marked << " reachable objects in " << markSeconds << "s ("
+         << (markSeconds > 0 ? marked / markSeconds : 0) << " objects/s)\n";
+    cout << "Pruned " << pruned << " unreachable objects (" << freedBytes << " bytes), "
+         << kept << " kept within grace period\n";
+    cout << "Scanned " << scanned << " objects in " << total << "s ("
+         << (total > 0 ? scanned / total : 0) << " objects/s)\n";
+    if (scanned < objects.size())
+        cout << "Time budget reached; " << objects.size() - scanned << " objects left for the next run\n";
+}
+
+/**
+ * @brief Verifies the integrity and connectivity of the object store.
+ *
+ * Every loose object is rehashed across all cores and compared with its file name.
+ * Then the history reachable from all refs is walked to check that every commit's
+ * tree and parents, and every tree's blobs, are present. In a partial repository,
+ * absent blobs are counted as promised rather than missing.
+ */
+void fsck()
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<string> objects = listObjects();
+    vector<string> packed = listPackedObjects();
+    objects.insert(objects.end(), packed.begin(), packed.end());
+    vector<string> corrupt;
+    mutex corruptLock;
+    atomic<uintmax_t> bytes{0};
+
+    parallelFor(objects.size(), [&](size_t i)
+                {
+        string content = readObject(objects[i]);
+        bytes += content.size();
+        if (generateHash(content) != objects[i])
+        {
+            lock_guard<mutex> guard(corruptLock);
+            corrupt.push_back(objects[i]);
+        } });
+    double hashSeconds = secondsSince(start);
+
+    size_t missing = 0;
+    ReachableSet reachable = markReachable(getRefTips());
+    for (const auto &hash : reachable.commits)
+    {
+        if (!objectExists(hash))
+        {
+            cerr << "missing commit " << hash << "\n";
+            missing++;
+        }
+    }
+    for (const auto &hash : reachable.trees)
+    {
+        if (!objectExists(hash))
+        {
+            cerr << "missing tree " << hash << "\n";
+            missing++;
+        }
+    }
+    // A partial repository may lack blobs; its promisor remote supplies them on demand
+    bool partial = !promisorRemote().empty();
+    size_t promised = 0;
+    for (const auto &hash : reachable.blobs)
+    {
+        if (objectExists(hash))
+            continue;
+        if (partial)
+            promised++;
+        else
+        {
+            cerr << "missing blob " << hash << "\n";
+            missing++;
+        }
+    }
+
+    for (const auto &hash : corrupt)
+        cerr << "hash mismatch " << hash << "\n";
+
+    double total = secondsSince(start);
+    cout << "Checked " << objects.size() << " objects (" << bytes << " bytes) in " << hashSeconds << "s ("
+         << (hashSeconds > 0 ? bytes / hashSeconds / (1024 * 1024) : 0) << " MB/s)\n";
+    cout << "Connectivity: " << reachable.commits.size() << " commits, " << reachable.trees.size()
+         << " trees, " << reachable.blobs.size() << " blobs reachable\n";
+    cout << corrupt.size() << " corrupt, " << missing << " missing";
+    if (partial)
+        cout << ", " << promised << " promised by " << promisorRemote();
+    cout << ", done in " << total << "s\n";
+}
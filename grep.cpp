@@ -0,0 +1,261 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <regex>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "helpers.hpp"
+
+using namespace std;
+
+struct GrepMatch
+{
+    size_t lineNumber;
+    string line;
+};
+
+struct BlobMatches
+{
+    bool binary = false;
+    vector<GrepMatch> matches;
+};
+
+const char *const REGEX_SPECIALS = ".[]()*+?{}|^$\\";
+
+/**
+ * @brief Finds a literal string every match of an extended regex must contain.
+ *
+ * Returns the longest run of plain characters that is not made optional by a
+ * following '*', '?' or '{'. Groups and bracket expressions end a run and are
+ * skipped; a top-level '|' means no single literal is required.
+ */
+static string requiredLiteral(const string &pattern)
+{
+    string best, run;
+    auto endRun = [&]()
+    {
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+    };
+
+    int depth = 0;
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size())
+        {
+            char next = pattern[++i];
+            if (depth == 0 && strchr(REGEX_SPECIALS, next) && next != '\0')
+            {
+                if (i + 1 < pattern.size() && strchr("*?{", pattern[i + 1]))
+                    endRun();
+                else
+                    run += next;
+            }
+            else
+                endRun(); // character classes like \w
+            continue;
+        }
+        if (c == '|' && depth == 0)
+            return "";
+        if (c == '[')
+        {
+            // ']' directly after '[' or '[^' is part of the set
+            size_t close = i + 1;
+            if (close < pattern.size() && pattern[close] == '^')
+                close++;
+            if (close < pattern.size() && pattern[close] == ']')
+                close++;
+            close = pattern.find(']', close);
+            i = close == string::npos ? pattern.size() : close;
+            endRun();
+            continue;
+        }
+        if (c == '(' || c == ')')
+        {
+            depth += c == '(' ? 1 : -1;
+            endRun();
+            continue;
+        }
+        if (depth > 0)
+            continue;
+        if (c == '*' || c == '?' || c == '{')
+        {
+            if (!run.empty())
+                run.pop_back();
+            endRun();
+            if (c == '{')
+                i = min(pattern.find('}', i), pattern.size());
+            continue;
+        }
+        if (strchr(REGEX_SPECIALS, c))
+        {
+            endRun();
+            continue;
+        }
+        if (i + 1 < pattern.size() && strchr("*?{", pattern[i + 1]))
+        {
+            endRun();
+            continue;
+        }
+        run += c;
+    }
+    endRun();
+    return best;
+}
+
+/**
+ * @brief Searches one blob.
+ *
+ * When the pattern has a required literal, memmem (vectorized in glibc) skips
+ * straight to candidate lines and the regex only runs on those; a pattern that is
+ * entirely literal never runs the regex at all.
+ */
+static BlobMatches searchBlob(const char *data, size_t size, const string &literal, bool literalOnly, const regex &re)
+{
+    BlobMatches result;
+    if (memchr(data, '\0', min<size_t>(size, 8000)))
+        result.binary = true;
+
+    const char *end = data + size;
+    const char *pos = data;
+    const char *counted = data;
+    size_t lineNumber = 1;
+    while (pos < end)
+    {
+        const char *lineStart = pos;
+        if (!literal.empty())
+        {
+            const char *hit = static_cast<const char *>(memmem(pos, end - pos, literal.data(), literal.size()));
+            if (!hit)
+                break;
+            lineStart = hit;
+            while (lineStart > pos && lineStart[-1] != '\n')
+                lineStart--;
+        }
+        const char *newline = static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+        const char *lineEnd = newline ? newline : end;
+
+        if (literalOnly || regex_search(lineStart, lineEnd, re))
+        {
+            if (result.binary)
+            {
+                result.matches.push_back({0, ""});
+                return result;
+            }
+            lineNumber += count(counted, lineStart, '\n');
+            counted = lineStart;
+            result.matches.push_back({lineNumber, string(lineStart, lineEnd)});
+        }
+        pos = lineEnd + 1;
+    }
+    return result;
+}
+
+// Maps an object's bytes straight from its loose file or pack and searches them
+static BlobMatches searchObject(const ObjectLocation &location, const string &literal, bool literalOnly, const regex &re)
+{
+    if (location.size == 0)
+        return {};
+    int fd = open(location.path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return {};
+    size_t pageOffset = location.offset % sysconf(_SC_PAGESIZE);
+    size_t length = location.size + pageOffset;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, location.offset - pageOffset);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return {};
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    BlobMatches result = searchBlob(static_cast<const char *>(mapping) + pageOffset, location.size, literal, literalOnly, re);
+    munmap(mapping, length);
+    return result;
+}
+
+/**
+ * @brief Prints the lines matching a pattern in the tree of a commit.
+ *
+ * Blobs are searched straight from the object store, without checking anything
+ * out. Each distinct blob is searched once however many paths share it, and the
+ * blobs are spread across all cores, largest first.
+ *
+ * @param pattern POSIX extended regular expression.
+ * @param commitRef Branch or commit to search; HEAD by default.
+ */
+void grepCommit(const string &pattern, const string &commitRef)
+{
+    string commit = resolveCommitish(commitRef);
+    if (commit.empty())
+    {
+        cerr << "Error: No such branch or commit: " << commitRef << "\n";
+        return;
+    }
+
+    regex re;
+    try
+    {
+        re = regex(pattern, regex::extended | regex::optimize);
+    }
+    catch (const regex_error &e)
+    {
+        cerr << "Error: Invalid pattern '" << pattern << "': " << e.what() << "\n";
+        return;
+    }
+    string literal = requiredLiteral(pattern);
+    bool literalOnly = !literal.empty() && pattern.find_first_of(REGEX_SPECIALS) == string::npos;
+
+    map<string, string> files = parseTreeObject(readObject(getTreeHashFromCommit(readObject(commit))));
+    vector<string> allBlobs;
+    for (const auto &[path, hash] : files)
+        allBlobs.push_back(hash);
+    fetchPromisedObjects(allBlobs); // one batch for a partial repository, instead of one per blob
+    unordered_map<string, size_t> blobIndex;
+    vector<pair<string, ObjectLocation>> blobs;
+    for (const auto &[path, hash] : files)
+    {
+        if (blobIndex.count(hash))
+            continue;
+        ObjectLocation location;
+        if (!locateObject(hash, location))
+        {
+            cerr << "Error: missing blob " << hash << " for " << path << "\n";
+            continue;
+        }
+        blobIndex[hash] = blobs.size();
+        blobs.emplace_back(hash, location);
+    }
+
+    vector<size_t> order(blobs.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](size_t a, size_t b)
+         { return blobs[a].second.size > blobs[b].second.size; });
+
+    vector<BlobMatches> results(blobs.size());
+    parallelFor(order.size(), [&](size_t i)
+                { results[order[i]] = searchObject(blobs[order[i]].second, literal, literalOnly, re); });
+
+    string out;
+    for (const auto &[path, hash] : files)
+    {
+        auto it = blobIndex.find(hash);
+        if (it == blobIndex.end())
+            continue;
+        const BlobMatches &result = results[it->second];
+        if (result.binary && !result.matches.empty())
+        {
+            out += "Binary file " + commitRef + ":" + path + " matches\n";
+            continue;
+        }
+        for (const auto &match : result.matches)
+            out += commitRef + ":" + path + ":" + to_string(match.lineNumber) + ":" + match.line + "\n";
+    }
+    cout << out;
+}
@@ -6,12 +6,119 @@
 #include <map>
 #include <vector>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <iterator>
+#include <sys/resource.h>
 #include <openssl/sha.h>
 #include "helpers.hpp"
 
 namespace fs = std::filesystem;
 using namespace std;
 
+// Located on first use, which may be from parallelFor workers, so guarded by repoPathsLock
+static mutex repoPathsLock;
+static string cachedGitDir, cachedCommonDir;
+static vector<string> cachedAlternates;
+static bool alternatesLoaded = false;
+
+/**
+ * @brief Locates the administrative directory of the current working tree.
+ *
+ * In the main working tree this is .minigit itself. In a linked worktree .minigit
+ * is a file containing "gitdir: <path>", pointing at .minigit/worktrees/<name> of
+ * the main repository, which holds that worktree's own HEAD and index.
+ */
+string gitDir()
+{
+    lock_guard<mutex> guard(repoPathsLock);
+    if (cachedGitDir.empty())
+    {
+        cachedGitDir = ".minigit";
+        if (fs::is_regular_file(".minigit"))
+        {
+            string link = trim(readFile(".minigit"));
+            if (link.rfind("gitdir: ", 0) == 0)
+                cachedGitDir = trim(link.substr(8));
+        }
+    }
+    return cachedGitDir;
+}
+
+// Directory holding what all worktrees share: objects, refs and config
+string commonDir()
+{
+    string dir = gitDir();
+    lock_guard<mutex> guard(repoPathsLock);
+    if (cachedCommonDir.empty())
+    {
+        string common = trim(readFile(dir + "/commondir"));
+        cachedCommonDir = common.empty() ? dir : common;
+    }
+    return cachedCommonDir;
+}
+
+// Forgets the located directories, e.g. after changing the working directory
+void resetRepoPaths()
+{
+    lock_guard<mutex> guard(repoPathsLock);
+    cachedGitDir.clear();
+    cachedCommonDir.clear();
+    cachedAlternates.clear();
+    alternatesLoaded = false;
+}
+
+// Per-worktree file such as HEAD or index
+string gitPath(const string &name)
+{
+    return gitDir() + "/" + name;
+}
+
+// Shared file such as config or refs/heads/<branch>
+string commonPath(const string &name)
+{
+    return commonDir() + "/" + name;
+}
+
+// Object directories of other repositories listed in objects/info/alternates
+const vector<string> &objectAlternates()
+{
+    string listPath = commonPath("objects/info/alternates");
+    lock_guard<mutex> guard(repoPathsLock);
+    if (!alternatesLoaded)
+    {
+        ifstream file(listPath);
+        string line;
+        while (getline(file, line))
+        {
+            line = trim(line);
+            if (!line.empty() && line[0] != '#')
+                cachedAlternates.push_back(line);
+        }
+        alternatesLoaded = true;
+    }
+    return cachedAlternates;
+}
+
+// Path of an object. Objects missing locally are looked up in the alternates;
+// the local path is returned when no store has it, so it can be written there.
+string objectPath(const string &hash)
+{
+    string local = commonDir() + "/objects/" + hash;
+    const vector<string> &alternates = objectAlternates();
+    if (alternates.empty() || hash.empty() || fs::exists(local))
+        return local;
+    for (const auto &dir : alternates)
+    {
+        string candidate = dir + "/" + hash;
+        if (fs::exists(candidate))
+            return candidate;
+    }
+    return local;
+}
+
 string saveBlobObject(const string &filePath)
 {
     ifstream inputFile(filePath);
@@ -26,9 +133,9 @@ string saveBlobObject(const string &filePath)
     string fileContent = fileContentStream.str();
 
     string blobHash = generateHash(fileContent);
-    string objectFilePath = ".minigit/objects/" + blobHash;
+    string objectFilePath = objectPath(blobHash);
 
-    if (!fs::exists(objectFilePath))
+    if (!objectExists(blobHash))
     {
         ofstream outputFile(objectFilePath);
         if (!outputFile)
@@ -63,13 +170,13 @@ string getTreeHashFromCommit(const string &commitContent)
 
 string get_current_commit()
 {
-    ifstream head(".minigit/HEAD");
+    ifstream head(gitPath("HEAD"));
     string ref;
     getline(head, ref);
     if (ref.rfind("ref: ", 0) == 0)
     {
         string refPath = ref.substr(5);
-        ifstream branchFile(".minigit/" + refPath);
+        ifstream branchFile(commonPath(refPath));
         string commitHash;
         getline(branchFile, commitHash);
         return commitHash;
@@ -96,27 +203,13 @@ bool check_mod(const string &path_to_file)
     string latestCommit = get_current_commit();
     if (latestCommit.empty())
         return true;
-    string commitContent = readFile(".minigit/objects/" + latestCommit);
+    string commitContent = readObject(latestCommit);
     string treeHash = getTreeHashFromCommit(commitContent);
     if (treeHash.empty())
         return true;
-    string blob_path;
-    istringstream treeStream(readFile(".minigit/objects/" + treeHash));
-    string line;
-    while (getline(treeStream, line))
-    {
-        if (line.find("tree ", 0) == 0)
-        {
-            istringstream iss(line);
-            string type, hash, filename;
-            iss >> type >> hash >> filename;
-            if ((filename) == path_to_file)
-            {
-                blob_path = hash;
-                break;
-            }
-        }
-    }
+    map<string, string> committed = parseTreeObject(readObject(treeHash));
+    auto entry = committed.find(path_to_file);
+    string blob_path = entry == committed.end() ? "" : entry->second;
     if (blob_path.empty())
     {
         return true; // File not found in the latest commit, consider it modified
@@ -124,7 +217,7 @@ bool check_mod(const string &path_to_file)
     else
     {
         string currentContent = trim(readFile(path_to_file));
-        string blobContent = trim(readFile(".minigit/objects/" + blob_path));
+        string blobContent = trim(readObject(blob_path));
         return currentContent != blobContent; // Check if content differs
     }
 }
@@ -154,38 +247,35 @@ map<string, string> parseTreeObject(const string &treeContent)
     string line;
     while (getline(ss, line))
     {
-        if (line.empty())
+        // "<type> <hash> <path>", where the path runs to the end of the line and may contain spaces
+        size_t first = line.find(' ');
+        size_t second = first == string::npos ? string::npos : line.find(' ', first + 1);
+        if (second == string::npos)
             continue;
-        istringstream iss(line);
-        string type, hash, filename;
-        iss >> type >> hash >> filename;
-        fileMap[filename] = hash;
+        string filename = line.substr(second + 1);
+        while (!filename.empty() && (filename.back() == '\r' || filename.back() == ' '))
+            filename.pop_back();
+        if (!filename.empty())
+            fileMap[filename] = line.substr(first + 1, second - first - 1);
     }
     return fileMap;
 }
 string read_index()
 {
-    ifstream indexFile(".minigit/index");
     stringstream ss;
-    string line;
-    while (getline(indexFile, line))
-    {
-        istringstream iss(line);
-        string filename, hash;
-        iss >> filename >> hash;
+    for (const auto &[filename, hash] : readIndexEntries())
         ss << "blob " << hash << " " << filename << "\n";
-    }
     return ss.str();
 }
 void update_current_branch(const string &commitHash)
 {
-    ifstream head(".minigit/HEAD");
+    ifstream head(gitPath("HEAD"));
     string ref;
     getline(head, ref);
     if (ref.rfind("ref: ", 0) == 0)
     {
         string refPath = ref.substr(5);
-        ofstream branchFile(".minigit/" + refPath);
+        ofstream branchFile(commonPath(refPath));
         branchFile << commitHash;
     }
 }
@@ -201,7 +291,7 @@ string get_timestamp()
 
 string get_author_data(void)
 {
-    ifstream config(".minigit/config");
+    ifstream config(commonPath("config"));
     string line, name, email;
 
     while (getline(config, line))
@@ -226,6 +316,85 @@ string get_author_data(void)
     }
 }
 
+// Reads "key = value" from .minigit/config; empty when the key is not set
+string get_config_value(const string &key)
+{
+    ifstream config(commonPath("config"));
+    string line;
+    string prefix = key + " = ";
+    while (getline(config, line))
+    {
+        if (line.find(prefix) == 0)
+            return trim(line.substr(prefix.size()));
+    }
+    return "";
+}
+
+void set_config_value(const string &key, const string &value)
+{
+    string content = readFile(commonPath("config"));
+    istringstream lines(content);
+    stringstream updated;
+    string line;
+    string prefix = key + " = ";
+    bool replaced = false;
+    while (getline(lines, line))
+    {
+        if (line.find(prefix) == 0)
+        {
+            line = prefix + value;
+            replaced = true;
+        }
+        updated << line << "\n";
+    }
+    if (!replaced)
+        updated << prefix << value << "\n";
+    writeFile(commonPath("config"), updated.str());
+}
+
+// The memoryBudget config value in bytes ("512m", "2g", ...); 0 means unlimited
+uintmax_t memoryBudget()
+{
+    string value = get_config_value("memoryBudget");
+    if (value.empty())
+        return 0;
+    try
+    {
+        size_t used = 0;
+        uintmax_t bytes = stoull(value, &used);
+        switch (used < value.size() ? tolower(value[used]) : 0)
+        {
+        case 'g':
+            bytes <<= 10;
+            [[fallthrough]];
+        case 'm':
+            bytes <<= 10;
+            [[fallthrough]];
+        case 'k':
+            bytes <<= 10;
+        }
+        return bytes;
+    }
+    catch (const exception &e)
+    {
+        cerr << "Warning: ignoring invalid memoryBudget '" << value << "'\n";
+        return 0;
+    }
+}
+
+// With a memory budget configured, reports the peak resident set size against it
+void reportPeakMemory(const string &command)
+{
+    uintmax_t budget = memoryBudget();
+    if (budget == 0)
+        return;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uintmax_t peak = (uintmax_t)usage.ru_maxrss * 1024;
+    cerr << command << ": peak RSS " << peak / (1024 * 1024) << " MiB, budget " << budget / (1024 * 1024) << " MiB"
+         << (peak > budget ? " (exceeded)" : "") << "\n";
+}
+
 string get_commit_parent(string &content)
 {
     istringstream lines(content);
@@ -242,58 +411,17 @@ string generate_tree(string &current_commit_hash)
 {
     map<string, string> latest_blobs; // path -> blob hash
 
-    // Step 1: Walk commit history and collect previous tree entries
-    string commit_hash = current_commit_hash;
-    while (!commit_hash.empty() && commit_hash != "null")
+    // Step 1: Start from the snapshot of the current commit
+    if (!current_commit_hash.empty() && current_commit_hash != "null")
     {
-        string commit_path = ".minigit/objects/" + commit_hash;
-        {
-            if (!fs::exists(commit_path))
-                break;
-
-            string commit_content = readFile(commit_path);
-            istringstream stream(commit_content);
-            string line;
-
-            while (getline(stream, line))
-            {
-                if (line.rfind("tree ", 0) == 0)
-                {
-                    // Format: tree <blob-hash> <path>
-                    size_t hash_start = 5;
-                    size_t hash_end = line.find(" ", hash_start);
-                    string hash = line.substr(hash_start, hash_end);
-                    string file = readFile(".minigit/objects/" + hash);
-                    string path, tmp1, tmp2;
-                    istringstream splitter(file);
-                    splitter >> tmp1 >> tmp2 >> path;
-                    cout << path << "\n";
-
-                    if (latest_blobs.count(path) == 0)
-                    {
-                        latest_blobs[path] = hash;
-                    }
-                }
-            }
-
-            commit_hash = get_commit_parent(commit_content);
-        }
+        string treeHash = getTreeHashFromCommit(readObject(current_commit_hash));
+        if (!treeHash.empty())
+            latest_blobs = parseTreeObject(readObject(treeHash));
     }
 
     // Step 2: Override with staged entries from index
-    ifstream indexFile(".minigit/index");
-    string line;
-    while (getline(indexFile, line))
-    {
-        istringstream iss(line);
-        string path, hash;
-        iss >> path >> hash;
-
-        if (!path.empty() && !hash.empty())
-        {
-            latest_blobs[path] = hash;
-        }
-    }
+    for (const auto &[path, hash] : readIndexEntries())
+        latest_blobs[path] = hash;
 
     // Step 3: Format as full tree snapshot
     stringstream result;
@@ -308,16 +436,14 @@ string generate_tree(string &current_commit_hash)
 vector<string> getModifiedFiles(const map<string, string> &committedFiles)
 {
     vector<string> modifiedFiles;
-    for (const auto &[filename, blobHash] : committedFiles)
+    for (const auto &[filename, blobHash] : filterSparse(committedFiles))
     {
         if (!fileExists(filename))
         {
             modifiedFiles.push_back(filename + " (deleted)");
             continue;
         }
-        string currentContent = readFile(filename);
-        string blobContent = readFile(".minigit/objects/" + blobHash);
-        if (currentContent != blobContent)
+        if (!fileMatchesObject(filename, blobHash))
         {
             modifiedFiles.push_back(filename + " (modified)");
         }
@@ -327,24 +453,26 @@ vector<string> getModifiedFiles(const map<string, string> &committedFiles)
 
 map<string, string> getCurrentTrackedFiles()
 {
-    string headContent = readFile(".minigit/HEAD");
+    string headContent = readFile(gitPath("HEAD"));
     string commitHash;
     if (headContent.find("ref: ") == 0)
     {
-        string refPath = ".minigit/" + trim(headContent.substr(5));
+        string refPath = commonPath(trim(headContent.substr(5)));
         commitHash = trim(readFile(refPath));
     }
     else
     {
         commitHash = trim(headContent); // Detached HEAD
     }
+    if (commitHash.empty())
+        return {};
 
-    string commitContent = readFile(".minigit/objects/" + commitHash);
+    string commitContent = readObject(commitHash);
     string treeHash = getTreeHashFromCommit(commitContent);
     if (treeHash.empty())
         return {};
 
-    string treeContent = readFile(".minigit/objects/" + treeHash);
+    string treeContent = readObject(treeHash);
     return parseTreeObject(treeContent); // filename -> blobHash
 }
 string generateHash(const string &content)
@@ -358,4 +486,286 @@ string generateHash(const string &content)
         hashStream << hex << setw(2) << setfill('0') << (int)hashBytes[i];
     }
     return hashStream.str();
-}
\ No newline at end of file
+}
+vector<string> get_commit_parents(const string &content)
+{
+    vector<string> parents;
+    istringstream lines(content);
+    string line;
+
+    while (getline(lines, line))
+    {
+        if (line.find("parent ", 0) == 0)
+            parents.push_back(trim(line.substr(7)));
+    }
+    return parents;
+}
+
+// Commit hashes every branch points at, plus the HEAD of any worktree that is detached
+vector<string> getRefTips()
+{
+    vector<string> tips;
+    if (fs::exists(commonPath("refs/heads")))
+    {
+        for (const auto &entry : fs::recursive_directory_iterator(commonPath("refs/heads")))
+        {
+            if (!entry.is_regular_file())
+                continue;
+            string hash = trim(readFile(entry.path().string()));
+            if (!hash.empty())
+                tips.push_back(hash);
+        }
+    }
+    for (const auto &dir : worktreeGitDirs())
+    {
+        string head = trim(readFile(dir + "/HEAD"));
+        if (!head.empty() && head.rfind("ref: ", 0) != 0)
+            tips.push_back(head);
+    }
+    return tips;
+}
+
+// Hashes of all loose objects in .minigit/objects
+vector<string> listObjects()
+{
+    vector<string> hashes;
+    for (const auto &entry : fs::directory_iterator(commonPath("objects")))
+    {
+        if (entry.is_regular_file())
+            hashes.push_back(entry.path().filename().string());
+    }
+    return hashes;
+}
+
+// Runs fn(0..count-1) across all cores; workers pull the next index from a shared counter
+void parallelFor(size_t count, const function<void(size_t)> &fn)
+{
+    size_t workers = max(1u, thread::hardware_concurrency());
+    workers = min(workers, count);
+    if (workers <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    atomic<size_t> next{0};
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; ++w)
+    {
+        pool.emplace_back([&]()
+                          {
+            for (size_t i = next++; i < count; i = next++)
+                fn(i); });
+    }
+    for (auto &t : pool)
+        t.join();
+}
+
+// Stores a tree object for the given path -> blob map and returns its hash
+string writeTreeObject(const map<string, string> &tree)
+{
+    stringstream content;
+    for (const auto &[path, hash] : tree)
+        content << "tree " << hash << " " << path << "\n";
+    return writeTreeContent(content.str());
+}
+
+// Stores a commit object dated now and returns its hash. The author defaults to
+// the configured one.
+string writeCommitObject(const string &treeHash, const vector<string> &parents, const string &message, const string &author)
+{
+    stringstream content;
+    content << "tree " << treeHash << "\n";
+    for (const auto &parent : parents)
+        content << "parent " << parent << "\n";
+    content << "author " << (author.empty() ? get_author_data() : author) << "\n";
+    content << "date " << get_timestamp() << "\n";
+    content << "message " << message << "\n";
+
+    string commitStr = content.str();
+    string commitHash = generateHash(commitStr);
+    writeFile(objectPath(commitHash), commitStr);
+    writeCommitBloom(commitHash);
+    return commitHash;
+}
+
+/**
+ * @brief Applies tree changes to the working tree.
+ *
+ * Paths whose new hash is empty are removed; all others are written from the
+ * object store in chunks, reading and writing each chunk in a batch. With
+ * checkoutReflink set, loose objects are cloned into place instead, which copies
+ * no data on copy-on-write filesystems. Paths outside the sparse checkout are skipped.
+ *
+ * @param changes (old hash, new hash) for every path that differs.
+ * @throws runtime_error if a file cannot be written.
+ */
+void updateWorkingTree(const vector<TreeEntryDiff> &changes)
+{
+    function<bool(const string &)> inSparse = sparseMatcher();
+    vector<string> blobHashes, paths;
+    for (const auto &change : changes)
+    {
+        if (!inSparse(change.path))
+            continue;
+        if (!change.hashes.back().empty())
+        {
+            paths.push_back(change.path);
+            blobHashes.push_back(change.hashes.back());
+        }
+        else if (fileExists(change.path))
+        {
+            fs::remove(change.path);
+            cout << "Removed: " << change.path << "\n";
+        }
+    }
+
+    // A partial repository fetches every missing blob in one request, not one per locate
+    fetchPromisedObjects(blobHashes);
+
+    const size_t chunk = 1024;
+    if (get_config_value("checkoutReflink") == "true")
+    {
+        // Packed objects have no file of their own, and a loose one may have been
+        // packed since it was located; both are copied out of the store instead
+        for (const auto &path : paths)
+        {
+            fs::path parent = fs::path(path).parent_path();
+            if (!parent.empty())
+                fs::create_directories(parent);
+        }
+        atomic<bool> cloned{true};
+        parallelFor(paths.size(), [&](size_t i)
+                    {
+            ObjectLocation location;
+            if (!locateObject(blobHashes[i], location))
+                cloned = false;
+            else if (location.packed || !cloneFile(location.path, paths[i]))
+                cloned = copyObjectToFile(blobHashes[i], paths[i]) && cloned; });
+        if (!cloned)
+            throw runtime_error("Failed to clone objects into working tree");
+        for (const auto &path : paths)
+            cout << "Updated: " << path << "\n";
+        return;
+    }
+    // Under a memory budget, a batch holds at most a quarter of it and larger
+    // blobs are copied from the object store in chunks
+    uintmax_t budget = memoryBudget();
+    vector<uintmax_t> sizes(paths.size(), 0);
+    if (budget > 0)
+    {
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            ObjectLocation location;
+            if (locateObject(blobHashes[i], location))
+                sizes[i] = location.size;
+        }
+    }
+    for (size_t begin = 0, end; begin < paths.size(); begin = end)
+    {
+        if (budget > 0 && sizes[begin] > budget / 4)
+        {
+            if (!copyObjectToFile(blobHashes[begin], paths[begin]))
+                throw runtime_error("Failed to write file: " + paths[begin]);
+            cout << "Updated: " << paths[begin] << "\n";
+            end = begin + 1;
+            continue;
+        }
+        uintmax_t bytes = 0;
+        for (end = begin; end < paths.size() && end - begin < chunk; ++end)
+        {
+            if (budget > 0 && (sizes[end] > budget / 4 || bytes + sizes[end] > budget / 4))
+                break;
+            bytes += sizes[end];
+        }
+        vector<bool> failed;
+        vector<string> blobs = readObjectsBatch(vector<string>(blobHashes.begin() + begin, blobHashes.begin() + end), &failed);
+        vector<pair<string, string>> files;
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (failed[i - begin])
+                throw runtime_error("Missing blob " + blobHashes[i] + " for " + paths[i]);
+            files.emplace_back(paths[i], move(blobs[i - begin]));
+        }
+        writeFilesBatch(files);
+        for (size_t i = begin; i < end; ++i)
+            cout << "Updated: " << paths[i] << "\n";
+    }
+}
+
+// Moves the working tree from one snapshot to another, touching only the paths
+// whose blob differs between the two
+void updateWorkingTree(const map<string, string> &from, const map<string, string> &to)
+{
+    vector<TreeEntryDiff> changes;
+    auto oldIt = from.begin(), newIt = to.begin();
+    while (oldIt != from.end() || newIt != to.end())
+    {
+        if (newIt == to.end() || (oldIt != from.end() && oldIt->first < newIt->first))
+        {
+            changes.push_back({oldIt->first, {oldIt->second, ""}});
+            ++oldIt;
+        }
+        else if (oldIt == from.end() || newIt->first < oldIt->first)
+        {
+            changes.push_back({newIt->first, {"", newIt->second}});
+            ++newIt;
+        }
+        else
+        {
+            if (oldIt->second != newIt->second)
+                changes.push_back({newIt->first, {oldIt->second, newIt->second}});
+            ++oldIt;
+            ++newIt;
+        }
+    }
+    updateWorkingTree(changes);
+}
+
+static bool isCommitObject(const string &hash)
+{
+    string content = readObject(hash);
+    return content.rfind("tree ", 0) == 0 && content.find("\ndate ") != string::npos;
+}
+
+/**
+ * @brief Resolves HEAD, a branch name, or a full or abbreviated commit hash.
+ *
+ * An abbreviation of at least 4 hex digits is looked up in the object index and
+ * must match exactly one commit; matching blobs and trees are ignored. An
+ * abbreviation matching several commits is reported with its candidates on stderr.
+ *
+ * @return The commit hash, or an empty string if the ref is unknown or ambiguous.
+ */
+string resolveCommitish(const string &ref)
+{
+    if (ref == "HEAD")
+    {
+        string head = trim(readFile(gitPath("HEAD")));
+        if (head.rfind("ref: ", 0) == 0)
+            return trim(readFile(commonPath(head.substr(5))));
+        return head;
+    }
+    if (!ref.empty() && fileExists(commonPath("refs/heads/" + ref)))
+        return trim(readFile(commonPath("refs/heads/" + ref)));
+    if (ref.size() == 40 && objectExists(ref))
+        return ref;
+    if (ref.size() < 4)
+        return "";
+    // Every match is needed: a commit beyond any limit could make the prefix ambiguous
+    vector<string> matches = objectsWithPrefix(ref, SIZE_MAX);
+    vector<string> commits;
+    copy_if(matches.begin(), matches.end(), back_inserter(commits), isCommitObject);
+    if (commits.size() > 1)
+    {
+        const size_t shown = 10;
+        cerr << "Error: short hash " << ref << " is ambiguous; candidates:\n";
+        for (size_t i = 0; i < commits.size() && i < shown; ++i)
+            cerr << "  " << commits[i] << " commit\n";
+        if (commits.size() > shown)
+            cerr << "  ... and " << commits.size() - shown << " more\n";
+        return "";
+    }
+    return commits.empty() ? "" : commits[0];
+}
@@ -1,8 +1,23 @@
+#pragma once
 #include <iostream>
+#include <fstream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <functional>
+#include <set>
+#include <string_view>
+#include <chrono>
 
 using namespace std;
+string gitDir();
+string commonDir();
+void resetRepoPaths();
+string gitPath(const string &name);
+string commonPath(const string &name);
+const vector<string> &objectAlternates();
+string objectPath(const string &hash);
 std::string saveBlobObject(const std::string &filePath);
 string trim(const string &s);
 string getTreeHashFromCommit(const string &commitContent);
@@ -20,4 +35,131 @@ map<string, string> getCurrentTrackedFiles();
 string get_author_data(void);
 string get_timestamp();
 void update_current_branch(const string &commitHash);
-map<string, string> parseTreeObject(const string &treeContent);
\ No newline at end of file
+map<string, string> parseTreeObject(const string &treeContent);
+vector<string> get_commit_parents(const string &content);
+vector<string> getRefTips();
+vector<string> worktreeGitDirs();
+
+struct ReachableSet
+{
+    unordered_set<string> commits;
+    unordered_set<string> trees;
+    unordered_set<string> blobs;
+    vector<string> unwalked; // commits not read before the deadline; empty when the walk finished
+};
+ReachableSet markReachable(const vector<string> &tips, bool commitsOnly = false, const unordered_set<string> &stopAt = {},
+                           chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max());
+struct PackedHistory
+{
+    unordered_set<string> stops; // commits whose whole history is packed
+    vector<string> pending;      // commits an interrupted walk has still to read
+};
+PackedHistory readPackedHistory();
+void writePackedHistory(const PackedHistory &history);
+vector<string> listObjects();
+void parallelFor(size_t count, const function<void(size_t)> &fn);
+string get_config_value(const string &key);
+void set_config_value(const string &key, const string &value);
+uintmax_t memoryBudget();
+void reportPeakMemory(const string &command);
+bool inSparseCheckout(const string &path);
+function<bool(const string &)> sparseMatcher();
+map<string, string> filterSparse(const map<string, string> &files);
+void writeCommitBloom(const string &commitHash);
+unordered_map<string, string> loadCommitBlooms();
+bool bloomMightContain(const string &filter, const string &path);
+vector<string> readFilesBatch(const vector<string> &paths, vector<bool> *failed = nullptr);
+void writeFilesBatch(const vector<pair<string, string>> &files);
+bool cloneFile(const string &source, const string &destination);
+string writeTreeObject(const map<string, string> &tree);
+string writeCommitObject(const string &treeHash, const vector<string> &parents, const string &message, const string &author = "");
+
+// One path whose blob differs between trees; hashes[i] is "" where tree i lacks the path
+struct TreeEntryDiff
+{
+    string path;
+    vector<string> hashes;
+};
+
+struct ObjectLocation;
+
+// Walks several tree objects in path order at once and yields only the paths
+// where they differ, without building a map of any of them
+class TreeDiffIterator
+{
+public:
+    explicit TreeDiffIterator(vector<string> treeContents);
+    TreeDiffIterator(const vector<string> &treeHashes, uintmax_t memoryBudget);
+    ~TreeDiffIterator();
+    TreeDiffIterator(const TreeDiffIterator &) = delete;
+    TreeDiffIterator &operator=(const TreeDiffIterator &) = delete;
+    bool next(TreeEntryDiff &entry);
+
+private:
+    struct Cursor
+    {
+        string content;                                 // the whole tree, when it fits in memory
+        size_t offset = 0;
+        vector<pair<string_view, string_view>> sorted;  // small trees not stored in path order
+        size_t index = 0;
+        ifstream stream;                                // otherwise the tree is read a line at a time
+        uintmax_t remaining = 0;
+        string line;
+        string spillPath;                               // large misordered tree, sorted on disk
+        string_view path, hash;
+        bool valid = false;
+        void advance();
+    };
+    void loadInMemory(Cursor &cursor);
+    void openStream(Cursor &cursor, const string &file, uintmax_t offset, uintmax_t size);
+    bool openObjectStream(Cursor &cursor, const string &hash, ObjectLocation &location);
+    vector<Cursor> cursors;
+    string current;
+};
+string treeHashOf(const string &commitHash);
+string writeTreeContent(const string &treeContent);
+string writeTreeWithChanges(const string &treeHash, const vector<TreeEntryDiff> &changes);
+void updateWorkingTree(const map<string, string> &from, const map<string, string> &to);
+void updateWorkingTree(const vector<TreeEntryDiff> &changes);
+
+struct TreeMergeResult
+{
+    vector<TreeEntryDiff> changes;  // (ours, merged) for every path the merge changed on our side
+    vector<string> conflicts;       // paths changed differently on both sides
+};
+TreeMergeResult mergeTrees(const string &baseTree, const string &ourTree, const string &theirTree);
+map<string, string> parse_tree(const string &commit_hash);
+string find_common_ancestor(const string &commit1, const string &commit2);
+string resolveCommitish(const string &ref);
+map<string, string> readIndexEntries();
+map<string, string> readIndexEntries(const string &indexPath);
+bool indexLookup(const string &path, string &hash);
+void updateIndex(const vector<pair<string, string>> &updates);
+void clearIndex();
+set<string> listWorkingFiles();
+set<string> getUntrackedFiles(const map<string, string> &trackedFiles);
+
+struct ObjectLocation
+{
+    string path;            // loose object file or pack file
+    uintmax_t offset = 0;   // start of the object in path
+    uintmax_t size = 0;
+    bool packed = false;
+};
+bool locateObject(const string &hash, ObjectLocation &location);
+bool relocateObject(const string &hash, ObjectLocation &location);
+bool objectExists(const string &hash);
+bool locateObjectIn(const string &objectsDir, const string &hash, ObjectLocation &location);
+string readObjectFrom(const string &objectsDir, const string &hash);
+string promisorRemote();
+size_t fetchPromisedObjects(const vector<string> &hashes);
+string readObject(const string &hash);
+vector<string> readObjectsBatch(const vector<string> &hashes, vector<bool> *failed = nullptr);
+vector<string> listPackedObjects(const string &objectsDir = "");
+vector<string> objectsWithPrefix(const string &prefix, size_t limit);
+string abbreviateHash(const string &hash, size_t minLength = 7);
+bool copyObjectToFile(const string &hash, const string &path);
+bool fileMatchesObject(const string &path, const string &hash);
+size_t packLooseObjects(const vector<string> &hashes, uintmax_t maxBytes, chrono::steady_clock::time_point deadline);
+vector<string> splitLines(const string &content);
+vector<int> diffLines(const vector<string> &oldLines, const vector<string> &newLines);
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <map>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// The index holds one "path hash" line per staged file, sorted by path with no
+// duplicates, after a header line that vouches for that order; the hash follows
+// the last space, so paths may contain spaces. It is never modified in place:
+// writers take index.lock, write the new version into it and rename it over the
+// index, so readers always see either the old or the new version in full.
+// Indexes from before the header may be unsorted and are rewritten when found.
+const string INDEX_HEADER = "# minigit index v2: sorted\n";
+
+map<string, string> readIndexEntries(const string &indexPath)
+{
+    map<string, string> entries;
+    ifstream indexFile(indexPath);
+    string line;
+    for (bool first = true; getline(indexFile, line); first = false)
+    {
+        if (first && line + "\n" == INDEX_HEADER)
+            continue;
+        size_t space = line.rfind(' ');
+        if (space == string::npos)
+            continue;
+        string path = line.substr(0, space), hash = trim(line.substr(space + 1));
+        if (!path.empty() && !hash.empty())
+            entries[path] = hash; // older appended indexes may repeat a path; the last line wins
+    }
+    return entries;
+}
+
+map<string, string> readIndexEntries()
+{
+    return readIndexEntries(gitPath("index"));
+}
+
+// Binary search of a sorted index; [lo, hi) always holds whole lines
+static bool searchSortedIndex(const char *data, size_t size, const string &path, string &hash)
+{
+    size_t lo = 0, hi = size;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        while (mid > lo && data[mid - 1] != '\n')
+            mid--;
+        const char *lineEnd = static_cast<const char *>(memchr(data + mid, '\n', hi - mid));
+        size_t end = lineEnd ? lineEnd - data : hi;
+        const char *space = static_cast<const char *>(memrchr(data + mid, ' ', end - mid));
+        size_t pathEnd = space ? space - data : end;
+
+        int cmp = string_view(data + mid, pathEnd - mid).compare(path);
+        if (cmp == 0)
+        {
+            hash = trim(string(data + pathEnd, end - pathEnd));
+            return true;
+        }
+        if (cmp < 0)
+            lo = end + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+static void rewriteIndex(const function<void(map<string, string> &)> &update);
+
+/**
+ * @brief Looks up a path in the index without reading all of it.
+ *
+ * The index is mapped into memory and binary searched: each probe backs up from
+ * the middle of the current range to the start of its line and compares that
+ * line's path. An index without the sorted header is rewritten sorted first, or
+ * read in full if another process holds the lock.
+ *
+ * @param path The path to look up.
+ * @param hash Receives the staged blob hash if the path is found.
+ * @return Whether the path is staged.
+ */
+bool indexLookup(const string &path, string &hash)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = open(gitPath("index").c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        const char *data = static_cast<const char *>(mapping);
+        bool sorted = size >= INDEX_HEADER.size() && memcmp(data, INDEX_HEADER.data(), INDEX_HEADER.size()) == 0;
+        bool found = sorted && searchSortedIndex(data + INDEX_HEADER.size(), size - INDEX_HEADER.size(), path, hash);
+        munmap(mapping, size);
+        if (sorted)
+            return found;
+        try
+        {
+            rewriteIndex([](map<string, string> &) {}); // rewriting sorts, deduplicates and adds the header
+        }
+        catch (const runtime_error &e)
+        {
+            break;
+        }
+    }
+
+    map<string, string> entries = readIndexEntries();
+    auto it = entries.find(path);
+    if (it == entries.end())
+        return false;
+    hash = it->second;
+    return true;
+}
+
+// Takes index.lock, lets update modify the entries and publishes the result
+static void rewriteIndex(const function<void(map<string, string> &)> &update)
+{
+    string indexPath = gitPath("index");
+    string lockPath = indexPath + ".lock";
+    int fd = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        throw runtime_error("Unable to create " + lockPath + ": another MiniGit process may be running");
+
+    map<string, string> entries = readIndexEntries(indexPath);
+    update(entries);
+
+    string content = INDEX_HEADER;
+    for (const auto &[path, hash] : entries)
+        content += path + " " + hash + "\n";
+
+    bool ok = true;
+    for (size_t written = 0; ok && written < content.size();)
+    {
+        ssize_t n = write(fd, content.data() + written, content.size() - written);
+        ok = n > 0;
+        written += ok ? n : 0;
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(lockPath.c_str(), indexPath.c_str()) != 0)
+    {
+        unlink(lockPath.c_str());
+        throw runtime_error("Failed to write index");
+    }
+}
+
+// Stages path -> hash pairs, replacing any existing entries for those paths
+void updateIndex(const vector<pair<string, string>> &updates)
+{
+    rewriteIndex([&](map<string, string> &entries)
+                 {
+        for (const auto &[path, hash] : updates)
+            entries[path] = hash; });
+}
+
+void clearIndex()
+{
+    rewriteIndex([](map<string, string> &entries)
+                 { entries.clear(); });
+}
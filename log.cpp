@@ -3,6 +3,15 @@
 #include <sstream>
 #include <string>
 #include <ctime>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include "helpers.hpp"
+#include "commands.hpp"
 
 using namespace std;
 // Reads the full contents of a file into a string
@@ -16,72 +25,567 @@ string readFileContents(const string &filePath)
     return contentBuffer.str();
 }
 
-// Displays the commit history log
-void printCommitLog()
+// Entries of a commit's tree at the path itself or below it
+static map<string, string> entriesUnder(const string &commitContent, const string &path)
 {
-    // Step 1: Read HEAD reference
-    ifstream headFile(".minigit/HEAD");
-    if (!headFile)
+    map<string, string> entries;
+    string treeHash = getTreeHashFromCommit(commitContent);
+    if (treeHash.empty())
+        return entries;
+    for (const auto &[file, hash] : parseTreeObject(readObject(treeHash)))
     {
-        cerr << "fatal: HEAD not found.\n";
-        return;
+        if (file == path || file.rfind(path + "/", 0) == 0)
+            entries[file] = hash;
     }
+    return entries;
+}
+
+// Whether a commit changed the path compared to its first parent
+static bool commitTouchesPath(const string &commitContent, const string &parentHash, const string &path)
+{
+    map<string, string> parentEntries;
+    if (!parentHash.empty())
+        parentEntries = entriesUnder(readObject(parentHash), path);
+    return entriesUnder(commitContent, path) != parentEntries;
+}
+
+struct LogCommit
+{
+    string hash;
+    string author;
+    string date;
+    string message;
+    vector<string> parents;
+    string content;
+};
 
-    string headRefLine;
-    getline(headFile, headRefLine);
-    if (headRefLine.find("ref: ") != 0)
+static bool readLogCommit(const string &hash, LogCommit &commit)
+{
+    commit.hash = hash;
+    commit.content = readObject(hash);
+    if (commit.content.empty())
+        return false;
+    istringstream commitStream(commit.content);
+    string commitLine;
+    while (getline(commitStream, commitLine))
     {
-        cerr << "fatal: invalid HEAD format.\n";
-        return;
+        if (commitLine.find("author ") == 0)
+            commit.author = commitLine.substr(7);
+        else if (commitLine.find("date ") == 0)
+            commit.date = commitLine.substr(5);
+        else if (commitLine.find("message ") == 0)
+            commit.message = commitLine.substr(8);
+        else if (commitLine.find("parent ") == 0)
+            commit.parents.push_back(trim(commitLine.substr(7)));
     }
+    return true;
+}
 
-    string branchRefPath = ".minigit/" + headRefLine.substr(5);
-    string latestCommitHash = readFileContents(branchRefPath);
-    if (latestCommitHash.empty())
+static string formatCommit(const LogCommit &commit, const string &format, size_t abbrev)
+{
+    string out;
+    for (size_t i = 0; i < format.size(); ++i)
     {
-        cerr << "fatal: no commits yet.\n";
-        return;
+        if (format[i] != '%' || i + 1 >= format.size())
+        {
+            out += format[i];
+            continue;
+        }
+        string rest = format.substr(i + 1, 2);
+        if (rest == "an")
+            out += commit.author.substr(0, commit.author.find(" <"));
+        else if (rest == "ad")
+            out += commit.date;
+        if (rest == "an" || rest == "ad")
+        {
+            i += 2;
+            continue;
+        }
+        switch (format[++i])
+        {
+        case 'H':
+            out += commit.hash;
+            break;
+        case 'h':
+            out += abbreviateHash(commit.hash, abbrev);
+            break;
+        case 'P':
+            for (size_t p = 0; p < commit.parents.size(); ++p)
+                out += (p ? " " : "") + commit.parents[p];
+            break;
+        case 'p':
+            for (size_t p = 0; p < commit.parents.size(); ++p)
+                out += (p ? " " : "") + abbreviateHash(commit.parents[p], abbrev);
+            break;
+        case 's':
+            out += commit.message;
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case '%':
+            out += '%';
+            break;
+        default:
+            out += '%';
+            out += format[i];
+        }
     }
+    return out + "\n";
+}
 
-    // Step 2: Walk through commit history
-    while (!latestCommitHash.empty())
+static string formatDefault(const LogCommit &commit, size_t abbrev)
+{
+    string out = "commit " + commit.hash + "\n";
+    if (commit.parents.size() > 1)
     {
-        string commitObjectPath = ".minigit/objects/" + latestCommitHash;
-        string commitContent = readFileContents(commitObjectPath);
-        if (commitContent.empty())
+        out += "Merge:";
+        for (const auto &parent : commit.parents)
+            out += " " + abbreviateHash(parent, abbrev);
+        out += "\n";
+    }
+    out += "Author: " + commit.author + "\n";
+    out += "Date:   " + commit.date + "\n\n";
+    out += "Message:   " + commit.message + "\n\n";
+    return out;
+}
+
+// Collects output and writes it in blocks that start small, so the first
+// screenful appears at once, and grow to keep later writes few and large
+struct LogWriter
+{
+    string buffer;
+    size_t threshold = 4096;
+
+    void add(const string &text)
+    {
+        buffer += text;
+        if (buffer.size() >= threshold)
+            flush();
+    }
+
+    void flush()
+    {
+        cout.write(buffer.data(), buffer.size());
+        cout.flush();
+        buffer.clear();
+        threshold = min<size_t>(threshold * 2, 1 << 20);
+    }
+};
+
+// Newest first; ties broken by hash so the order is deterministic
+struct NewerFirst
+{
+    bool operator()(const LogCommit &a, const LogCommit &b) const
+    {
+        return a.date != b.date ? a.date < b.date : a.hash < b.hash;
+    }
+};
+
+// Line counts for one file a commit changed; binary files have none
+struct FileStat
+{
+    string path;
+    size_t added = 0;
+    size_t deleted = 0;
+    bool binary = false;
+};
+
+using TreeEntries = vector<pair<string, string>>; // (path, blob) in path order
+
+const size_t STAT_WINDOW = 256;
+const size_t STAT_PAIR_CACHE_LIMIT = 1 << 18;
+const size_t STAT_GRAPH_WIDTH = 40;
+
+static TreeEntries loadTreeEntries(const string &treeHash)
+{
+    TreeEntries entries;
+    // Against an empty tree every entry differs, so this lists the tree in path order
+    TreeDiffIterator tree({readObject(treeHash), ""});
+    for (TreeEntryDiff entry; tree.next(entry);)
+        entries.emplace_back(entry.path, entry.hashes[0]);
+    return entries;
+}
+
+static bool looksBinary(const string &content)
+{
+    return memchr(content.data(), '\0', min<size_t>(content.size(), 8000)) != nullptr;
+}
+
+static FileStat countChangedLines(const string &oldBlob, const string &newBlob)
+{
+    FileStat stat;
+    string oldContent = oldBlob.empty() ? "" : readObject(oldBlob);
+    string newContent = newBlob.empty() ? "" : readObject(newBlob);
+    if (looksBinary(oldContent) || looksBinary(newContent))
+    {
+        stat.binary = true;
+        return stat;
+    }
+    vector<string> oldLines = splitLines(oldContent);
+    vector<string> newLines = splitLines(newContent);
+    vector<int> matches = diffLines(oldLines, newLines);
+    size_t kept = count_if(matches.begin(), matches.end(), [](int match)
+                           { return match >= 0; });
+    stat.added = newLines.size() - kept;
+    stat.deleted = oldLines.size() - kept;
+    return stat;
+}
+
+// Computes the per-file statistics of log --stat/--numstat a window of commits at a
+// time, spreading the tree diffs and line counts of a window across all cores.
+// Parsed trees stay cached from one window to the next, since the parent tree of
+// the last commit in a window is usually the tree of the first in the next, and
+// line counts are cached per (old blob, new blob) pair, so a change seen on several
+// branches, or reverted and reapplied, is only diffed once.
+struct LogStats
+{
+    string limitPath;
+    unordered_map<string, TreeEntries> trees;
+    unordered_map<string, FileStat> pairs; // "<old blob>:<new blob>" -> line counts
+
+    explicit LogStats(const string &limitPath) : limitPath(limitPath) {}
+
+    // Statistics of each commit against its first parent, in the order given
+    vector<vector<FileStat>> compute(const vector<LogCommit> &commits)
+    {
+        size_t n = commits.size();
+        unordered_map<string, size_t> position;
+        for (size_t i = 0; i < n; ++i)
+            position[commits[i].hash] = i;
+        vector<string> newTrees(n), oldTrees(n);
+        parallelFor(n, [&](size_t i)
+                    {
+            newTrees[i] = getTreeHashFromCommit(commits[i].content);
+            if (commits[i].parents.empty())
+                return;
+            auto parent = position.find(commits[i].parents[0]);
+            oldTrees[i] = getTreeHashFromCommit(parent != position.end() ? commits[parent->second].content
+                                                                         : readObject(commits[i].parents[0])); });
+
+        // Keep only the trees this window needs and parse the missing ones in parallel
+        unordered_set<string> needed(newTrees.begin(), newTrees.end());
+        needed.insert(oldTrees.begin(), oldTrees.end());
+        needed.erase("");
+        for (auto it = trees.begin(); it != trees.end();)
+            it = needed.count(it->first) ? next(it) : trees.erase(it);
+        vector<string> toLoad;
+        for (const auto &hash : needed)
         {
-            cerr << "fatal: commit object not found: " << latestCommitHash << "\n";
-            break;
+            if (!trees.count(hash))
+                toLoad.push_back(hash);
         }
+        vector<TreeEntries> loaded(toLoad.size());
+        parallelFor(toLoad.size(), [&](size_t i)
+                    { loaded[i] = loadTreeEntries(toLoad[i]); });
+        for (size_t i = 0; i < toLoad.size(); ++i)
+            trees[toLoad[i]] = move(loaded[i]);
 
-        string commitAuthor, commitDate, commitMessage, parentCommitHash;
-        istringstream commitStream(commitContent);
-        string commitLine;
-        while (getline(commitStream, commitLine))
+        // Merge-join each commit's tree with its parent's
+        static const TreeEntries emptyTree;
+        auto entriesOf = [&](const string &hash) -> const TreeEntries &
+        { return hash.empty() ? emptyTree : trees.at(hash); };
+        vector<vector<TreeEntryDiff>> changes(n);
+        parallelFor(n, [&](size_t i)
+                    {
+            const TreeEntries &from = entriesOf(oldTrees[i]), &to = entriesOf(newTrees[i]);
+            auto inLimit = [&](const string &path)
+            { return limitPath.empty() || path == limitPath || path.rfind(limitPath + "/", 0) == 0; };
+            size_t a = 0, b = 0;
+            while (a < from.size() || b < to.size())
+            {
+                if (b == to.size() || (a < from.size() && from[a].first < to[b].first))
+                {
+                    if (inLimit(from[a].first))
+                        changes[i].push_back({from[a].first, {from[a].second, ""}});
+                    a++;
+                }
+                else if (a == from.size() || to[b].first < from[a].first)
+                {
+                    if (inLimit(to[b].first))
+                        changes[i].push_back({to[b].first, {"", to[b].second}});
+                    b++;
+                }
+                else
+                {
+                    if (from[a].second != to[b].second && inLimit(to[b].first))
+                        changes[i].push_back({to[b].first, {from[a].second, to[b].second}});
+                    a++;
+                    b++;
+                }
+            } });
+
+        // Count lines for every blob pair not already cached
+        if (pairs.size() > STAT_PAIR_CACHE_LIMIT)
+            pairs.clear();
+        vector<pair<string, string>> uncounted;
+        vector<string> blobs;
+        unordered_set<string> queued;
+        for (const auto &commitChanges : changes)
         {
-            if (commitLine.find("author ") == 0)
+            for (const auto &change : commitChanges)
             {
-                commitAuthor = commitLine.substr(7);
+                string key = change.hashes[0] + ":" + change.hashes[1];
+                if (!pairs.count(key) && queued.insert(key).second)
+                {
+                    uncounted.emplace_back(change.hashes[0], change.hashes[1]);
+                    blobs.push_back(change.hashes[0]);
+                    blobs.push_back(change.hashes[1]);
+                }
             }
-            else if (commitLine.find("date ") == 0)
+        }
+        fetchPromisedObjects(blobs);
+        vector<FileStat> counted(uncounted.size());
+        parallelFor(uncounted.size(), [&](size_t i)
+                    { counted[i] = countChangedLines(uncounted[i].first, uncounted[i].second); });
+        for (size_t i = 0; i < uncounted.size(); ++i)
+            pairs[uncounted[i].first + ":" + uncounted[i].second] = counted[i];
+
+        vector<vector<FileStat>> stats(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (const auto &change : changes[i])
             {
-                commitDate = commitLine.substr(5);
+                FileStat stat = pairs[change.hashes[0] + ":" + change.hashes[1]];
+                stat.path = change.path;
+                stats[i].push_back(move(stat));
             }
-            else if (commitLine.find("message ") == 0)
+        }
+        return stats;
+    }
+};
+
+static string formatNumstat(const vector<FileStat> &files)
+{
+    string out;
+    for (const auto &file : files)
+    {
+        if (file.binary)
+            out += "-\t-\t" + file.path + "\n";
+        else
+            out += to_string(file.added) + "\t" + to_string(file.deleted) + "\t" + file.path + "\n";
+    }
+    return out;
+}
+
+// " path | 12 ++++--" per file, scaled to STAT_GRAPH_WIDTH, then the totals
+static string formatStat(const vector<FileStat> &files)
+{
+    if (files.empty())
+        return "";
+    size_t pathWidth = 0, most = 0, added = 0, deleted = 0;
+    for (const auto &file : files)
+    {
+        pathWidth = max(pathWidth, file.path.size());
+        most = max(most, file.added + file.deleted);
+        added += file.added;
+        deleted += file.deleted;
+    }
+    size_t countWidth = max<size_t>(3, to_string(most).size());
+    ostringstream out;
+    for (const auto &file : files)
+    {
+        out << " " << left << setw(pathWidth) << file.path << " | " << right << setw(countWidth);
+        if (file.binary)
+        {
+            out << "Bin\n";
+            continue;
+        }
+        size_t plus = file.added, minus = file.deleted;
+        if (most > STAT_GRAPH_WIDTH)
+        {
+            plus = plus ? max<size_t>(1, plus * STAT_GRAPH_WIDTH / most) : 0;
+            minus = minus ? max<size_t>(1, minus * STAT_GRAPH_WIDTH / most) : 0;
+        }
+        out << file.added + file.deleted << " " << string(plus, '+') << string(minus, '-') << "\n";
+    }
+    out << " " << files.size() << (files.size() == 1 ? " file changed" : " files changed");
+    if (added)
+        out << ", " << added << (added == 1 ? " insertion(+)" : " insertions(+)");
+    if (deleted)
+        out << ", " << deleted << (deleted == 1 ? " deletion(-)" : " deletions(-)");
+    out << "\n";
+    return out.str();
+}
+
+/**
+ * @brief Displays the history reachable from a revision, following every parent.
+ *
+ * By default commits come out newest first from a priority queue on the commit
+ * date, so only the frontier of the walk is held in memory and the walk stops as
+ * soon as -n commits were shown or the frontier is older than --since. With
+ * topoOrder the whole history is read first and no commit is shown before all
+ * of its children. With a path, commits that do not change it relative to their
+ * first parent are skipped, using the changed-path Bloom filters where available.
+ *
+ * With stat or numstat, shown commits are collected into windows whose statistics
+ * are computed in parallel by LogStats and then written in order. Under a memory
+ * budget a window holds fewer commits, so that its parsed trees stay within it.
+ */
+void printCommitLog(const LogOptions &options)
+{
+    string limitPath = options.path;
+    while (!limitPath.empty() && limitPath.back() == '/')
+        limitPath.pop_back();
+    unordered_map<string, string> blooms;
+    if (!limitPath.empty())
+        blooms = loadCommitBlooms();
+
+    string tip = resolveCommitish(options.revision);
+    if (tip.empty())
+    {
+        if (options.revision == "HEAD")
+            cerr << "fatal: no commits yet.\n";
+        else
+            cerr << "fatal: bad revision '" << options.revision << "'\n";
+        return;
+    }
+
+    // A date-only --until covers that whole day
+    string until = options.until.size() == 10 ? options.until + " 23:59:59" : options.until;
+    string format = options.oneline ? "%h %s" : options.format;
+
+    auto shown = [&](const LogCommit &commit)
+    {
+        if (!until.empty() && commit.date > until)
+            return false;
+        if (limitPath.empty())
+            return true;
+        // The Bloom filter rules out most commits without parsing any tree
+        auto filter = blooms.find(commit.hash);
+        if (filter != blooms.end() && !bloomMightContain(filter->second, limitPath))
+            return false;
+        return commitTouchesPath(commit.content, commit.parents.empty() ? "" : commit.parents[0], limitPath);
+    };
+
+    LogWriter writer;
+    size_t count = 0;
+    auto formatted = [&](const LogCommit &commit)
+    { return format.empty() ? formatDefault(commit, options.abbrev) : formatCommit(commit, format, options.abbrev); };
+
+    bool withStats = options.stat || options.numstat;
+    LogStats stats(limitPath);
+    vector<LogCommit> window;
+    size_t windowSize = STAT_WINDOW;
+    auto flushWindow = [&]()
+    {
+        vector<vector<FileStat>> files = stats.compute(window);
+        for (size_t i = 0; i < window.size(); ++i)
+        {
+            string block = (options.numstat ? formatNumstat(files[i]) : "") + (options.stat ? formatStat(files[i]) : "");
+            writer.add(formatted(window[i]) + block + (block.empty() ? "" : "\n"));
+        }
+        window.clear();
+    };
+    auto emit = [&](const LogCommit &commit)
+    {
+        count++;
+        if (!withStats)
+        {
+            writer.add(formatted(commit));
+            return;
+        }
+        window.push_back(commit);
+        if (window.size() >= windowSize)
+            flushWindow();
+    };
+    auto finish = [&]()
+    {
+        if (!window.empty())
+            flushWindow();
+        writer.flush();
+    };
+    auto done = [&]()
+    { return options.maxCount && count >= options.maxCount; };
+    auto tooOld = [&](const LogCommit &commit)
+    { return !options.since.empty() && commit.date < options.since; };
+
+    unordered_set<string> seen = {tip};
+    priority_queue<LogCommit, vector<LogCommit>, NewerFirst> queue;
+    LogCommit start;
+    if (!readLogCommit(tip, start))
+    {
+        cerr << "fatal: commit object not found: " << tip << "\n";
+        return;
+    }
+    // Size windows so their trees, at about four times the tip's raw tree each, fit the budget
+    uintmax_t budget = memoryBudget();
+    ObjectLocation tipTree;
+    if (withStats && budget > 0 && locateObject(getTreeHashFromCommit(start.content), tipTree) && tipTree.size > 0)
+        windowSize = max<uintmax_t>(1, min<uintmax_t>(STAT_WINDOW, budget / (4 * tipTree.size)));
+    queue.push(move(start));
+
+    if (!options.topoOrder)
+    {
+        while (!queue.empty() && !done())
+        {
+            LogCommit commit = queue.top();
+            queue.pop();
+            if (tooOld(commit))
+                break; // everything left in the queue is older still
+            if (shown(commit))
+                emit(commit);
+            for (const auto &parent : commit.parents)
             {
-                commitMessage = commitLine.substr(8);
+                LogCommit next;
+                if (seen.insert(parent).second && readLogCommit(parent, next))
+                    queue.push(move(next));
             }
-            else if (commitLine.find("parent ") == 0)
+        }
+        finish();
+        return;
+    }
+
+    // Topological order: read the history down to --since, count each commit's
+    // children, then repeatedly show the newest commit whose children are all shown
+    unordered_map<string, LogCommit> commits;
+    unordered_map<string, size_t> pendingChildren;
+    vector<string> stack = {tip};
+    commits[tip] = queue.top();
+    queue.pop();
+    while (!stack.empty())
+    {
+        string hash = stack.back();
+        stack.pop_back();
+        for (const auto &parent : commits[hash].parents)
+        {
+            if (seen.insert(parent).second)
             {
-                parentCommitHash = commitLine.substr(7);
+                LogCommit next;
+                if (!readLogCommit(parent, next) || tooOld(next))
+                    continue;
+                if (limitPath.empty() && !withStats)
+                    next.content.clear(); // only needed for path limiting and statistics
+                commits[parent] = move(next);
+                stack.push_back(parent);
             }
+            if (commits.count(parent))
+                pendingChildren[parent]++;
         }
+    }
 
-        cout << "commit " << latestCommitHash << "\n";
-        cout << "Author: " << commitAuthor << "\n";
-        cout << "Date:   " << commitDate << "\n\n";
-        cout << "Message:   " << commitMessage << "\n\n";
-
-        latestCommitHash = parentCommitHash;
+    queue.push(commits[tip]);
+    while (!queue.empty() && !done())
+    {
+        LogCommit commit = queue.top();
+        queue.pop();
+        if (shown(commit))
+            emit(commit);
+        for (const auto &parent : commit.parents)
+        {
+            auto it = commits.find(parent);
+            if (it != commits.end() && --pendingChildren[parent] == 0)
+                queue.push(move(it->second));
+        }
+        commits.erase(commit.hash);
     }
+    finish();
+}
+
+// Displays the commit history log, optionally limited to commits touching a path
+void printCommitLog(const string &path)
+{
+    LogOptions options;
+    options.path = path;
+    printCommitLog(options);
 }
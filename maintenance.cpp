@@ -0,0 +1,269 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include "helpers.hpp"
+#include "commands.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Maintenance takes its own lock, never index.lock, so user commands keep running
+// while it works. Objects are only ever added to packs before their loose copies
+// are removed, so readers always find them in one place or the other.
+const vector<string> MAINTENANCE_TASKS = {"loose-objects", "commit-graph", "prune"};
+const long long STALE_LOCK_SECONDS = 60 * 60;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool acquireMaintenanceLock()
+{
+    string lockPath = commonPath("maintenance.lock");
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0)
+        {
+            string pid = to_string(getpid()) + "\n";
+            ssize_t written = write(fd, pid.data(), pid.size());
+            (void)written;
+            close(fd);
+            return true;
+        }
+
+        // A lock left behind by a killed run would otherwise disable maintenance forever
+        string owner = trim(readFile(lockPath));
+        bool ownerGone = !owner.empty() && owner.find_first_not_of("0123456789") == string::npos && kill(stoi(owner), 0) != 0;
+        error_code ec;
+        auto age = fs::file_time_type::clock::now() - fs::last_write_time(lockPath, ec);
+        if (!ownerGone && (ec || age < chrono::seconds(STALE_LOCK_SECONDS)))
+            return false;
+        fs::remove(lockPath, ec);
+    }
+    return false;
+}
+
+// Grace period of the prune task: config pruneGracePeriod in seconds, else two weeks
+static long long pruneGracePeriod()
+{
+    string value = get_config_value("pruneGracePeriod");
+    if (!value.empty() && value.find_first_not_of("0123456789") == string::npos)
+        return stoll(value);
+    return 14 * 24 * 60 * 60;
+}
+
+static void logTask(const string &task, double seconds, const string &detail)
+{
+    ofstream log(commonPath("maintenance.log"), ios::app);
+    log << get_timestamp() << " " << task << " " << seconds << "s " << detail << "\n";
+    cout << task << ": " << detail << " (" << seconds << "s)\n";
+}
+
+// Packs loose objects reachable from the refs; unreachable ones stay loose so prune can remove them.
+// Only history added since the last complete run is walked, and a walk cut short by
+// the deadline is resumed by the next run.
+static string packLooseTask(uintmax_t ioBudgetBytes, chrono::steady_clock::time_point deadline)
+{
+    PackedHistory history = readPackedHistory();
+    vector<string> tips = getRefTips();
+    vector<string> starts = tips;
+    starts.insert(starts.end(), history.pending.begin(), history.pending.end());
+    // The walk may take half of the time left, so a run that cannot finish it still
+    // packs what it found and the next run makes further progress
+    auto now = chrono::steady_clock::now();
+    auto walkDeadline = deadline == chrono::steady_clock::time_point::max() || deadline <= now ? deadline : now + (deadline - now) / 2;
+    ReachableSet reachable = markReachable(starts, false, history.stops, walkDeadline);
+
+    vector<string> candidates;
+    for (const auto &hash : listObjects())
+    {
+        bool isObject = hash.size() == 40 && hash.find_first_not_of("0123456789abcdef") == string::npos;
+        if (isObject && (reachable.commits.count(hash) || reachable.trees.count(hash) || reachable.blobs.count(hash)))
+            candidates.push_back(hash);
+    }
+    sort(candidates.begin(), candidates.end());
+
+    size_t packed = packLooseObjects(candidates, ioBudgetBytes, deadline);
+    // Once everything walked is packed, the walked commits become stops. A finished
+    // walk covers the whole history of the tips, which then replace the old stops.
+    if (packed == candidates.size())
+    {
+        if (reachable.unwalked.empty())
+            history = {unordered_set<string>(tips.begin(), tips.end()), {}};
+        else
+        {
+            unordered_set<string> unwalked(reachable.unwalked.begin(), reachable.unwalked.end());
+            for (const auto &commit : reachable.commits)
+            {
+                if (!unwalked.count(commit))
+                    history.stops.insert(commit);
+            }
+            history.pending = reachable.unwalked;
+        }
+        writePackedHistory(history);
+    }
+
+    stringstream detail;
+    detail << "packed " << packed << " of " << candidates.size() << " loose objects";
+    if (!reachable.unwalked.empty())
+        detail << ", history walk resumes next run";
+    return detail.str();
+}
+
+/**
+ * @brief Runs maintenance tasks within a time and I/O budget.
+ *
+ * Tasks run in order and are skipped once the time budget is used up; the
+ * loose-objects task also stops packing at the I/O budget, and commit-graph and
+ * prune stop at the time budget, leaving the rest for the next run. Prune keeps
+ * unreachable objects younger than the pruneGracePeriod setting (in seconds, two
+ * weeks by default). Every task's duration is appended to maintenance.log.
+ *
+ * @param tasks Any of loose-objects, commit-graph and prune; empty runs all of them.
+ * @param timeBudgetSeconds Wall-clock time the run may take.
+ * @param ioBudgetBytes Bytes of objects one run may pack.
+ */
+void maintenanceRun(const vector<string> &tasks, long long timeBudgetSeconds, uintmax_t ioBudgetBytes)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+    for (const auto &task : tasks)
+    {
+        if (find(MAINTENANCE_TASKS.begin(), MAINTENANCE_TASKS.end(), task) == MAINTENANCE_TASKS.end())
+        {
+            cerr << "Error: Unknown maintenance task: " << task << "\n";
+            return;
+        }
+    }
+    if (!acquireMaintenanceLock())
+    {
+        cerr << "Maintenance is already running; skipping.\n";
+        return;
+    }
+
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::seconds(timeBudgetSeconds);
+    for (const auto &task : tasks.empty() ? MAINTENANCE_TASKS : tasks)
+    {
+        if (chrono::steady_clock::now() >= deadline)
+        {
+            logTask(task, 0, "skipped, time budget exhausted");
+            continue;
+        }
+        auto taskStart = chrono::steady_clock::now();
+        string detail;
+        try
+        {
+            if (task == "loose-objects")
+                detail = packLooseTask(ioBudgetBytes, deadline);
+            else if (task == "commit-graph")
+            {
+                updateCommitBlooms(deadline);
+                detail = "changed-path filters updated";
+            }
+            else if (task == "prune")
+            {
+                garbageCollect(pruneGracePeriod(), deadline);
+                detail = "unreachable loose objects pruned";
+            }
+        }
+        catch (const exception &e)
+        {
+            detail = string("failed: ") + e.what();
+        }
+        logTask(task, secondsSince(taskStart), detail);
+    }
+    logTask("total", secondsSince(start), "maintenance run finished");
+    fs::remove(commonPath("maintenance.lock"));
+}
+
+/**
+ * @brief Starts a background process that runs maintenance periodically.
+ *
+ * The process detaches from the terminal, lowers its priority so it does not
+ * compete with user commands, and records its pid in maintenance.pid.
+ *
+ * @param intervalSeconds Time between runs.
+ */
+void maintenanceStart(long long intervalSeconds)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+    string pidPath = commonPath("maintenance.pid");
+    string running = trim(readFile(pidPath));
+    if (!running.empty() && kill(stoi(running), 0) == 0)
+    {
+        cerr << "Maintenance is already scheduled (pid " << running << ").\n";
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        cerr << "Error: Could not start background maintenance.\n";
+        return;
+    }
+    if (pid > 0)
+    {
+        cout << "Background maintenance started (pid " << pid << "), every " << intervalSeconds << "s\n";
+        return;
+    }
+
+    setsid();
+    writeFile(pidPath, to_string(getpid()) + "\n");
+    if (nice(10) == -1)
+    {
+        // Running at normal priority is still correct
+    }
+    int devNull = open("/dev/null", O_RDWR);
+    if (devNull >= 0)
+    {
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        close(devNull);
+    }
+
+    long long budget = max(1LL, intervalSeconds / 2);
+    while (fs::exists(commonDir()) && trim(readFile(pidPath)) == to_string(getpid()))
+    {
+        maintenanceRun({}, budget, 64 * 1024 * 1024);
+        this_thread::sleep_for(chrono::seconds(intervalSeconds));
+    }
+    _exit(0);
+}
+
+/**
+ * @brief Stops the background maintenance process started by maintenanceStart.
+ */
+void maintenanceStop()
+{
+    string pidPath = commonPath("maintenance.pid");
+    string pid = trim(readFile(pidPath));
+    if (pid.empty())
+    {
+        cout << "Background maintenance is not running.\n";
+        return;
+    }
+    // Removing the pid file also makes the process exit after its current run
+    fs::remove(pidPath);
+    kill(stoi(pid), SIGTERM);
+    cout << "Stopped background maintenance (pid " << pid << ").\n";
+}
@@ -32,13 +32,15 @@ using namespace std;
 map<string, string> parse_tree(const string &commit_hash)
 {
     map<string, string> tree;
-    string content = readFile(".minigit/objects/" + commit_hash);
+    string content = readObject(commit_hash);
     istringstream stream(content);
     string line;
 
     // Only parse the tree object, not the commit object
-    // If commit_hash is a commit, extract the tree hash and parse that object
-    if (content.rfind("tree ", 0) != 0)
+    // If commit_hash is a commit, extract the tree hash and parse that object.
+    // A commit's first line is "tree <hash>", a tree's is "tree <hash> <path>".
+    string first_line = content.substr(0, content.find('\n'));
+    if (first_line.find(' ', 5) == string::npos)
     {
         // This is a commit object, extract the tree hash
         istringstream commit_stream(content);
@@ -55,7 +57,7 @@ map<string, string> parse_tree(const string &commit_hash)
         }
         if (tree_hash.empty())
             return tree;
-        content = readFile(".minigit/objects/" + tree_hash);
+        content = readObject(tree_hash);
         stream.clear();
         stream.str(content);
     }
@@ -82,7 +84,7 @@ map<string, string> parse_tree(const string &commit_hash)
 vector<string> get_parents_from_commit(const string &commit_hash)
 {
     vector<string> parents;
-    string content = readFile(".minigit/objects/" + commit_hash);
+    string content = readObject(commit_hash);
     istringstream stream(content);
     string line;
 
@@ -137,10 +139,78 @@ string find_common_ancestor(const string &commit1, const string &commit2)
     return "";
 }
 
+/**
+ * @brief Three-way merges two trees against their base without writing anything.
+ *
+ * The three trees are walked together with TreeDiffIterator, so only paths that
+ * differ somewhere are looked at, and trees beyond the memory budget are streamed.
+ * A path takes the side that changed it; if both sides changed it differently it
+ * is reported as a conflict. writeTreeWithChanges turns the result into a tree.
+ *
+ * @param base_tree, our_tree, their_tree Tree hashes ("" for an empty tree).
+ * @return The changes the merge makes to our tree and the conflicting paths (if any).
+ */
+TreeMergeResult mergeTrees(const string &base_tree, const string &our_tree, const string &their_tree)
+{
+    TreeMergeResult result;
+    TreeDiffIterator diff({base_tree, our_tree, their_tree}, memoryBudget());
+    for (TreeEntryDiff entry; diff.next(entry);)
+    {
+        const string &base = entry.hashes[0];
+        const string &ours = entry.hashes[1];
+        const string &theirs = entry.hashes[2];
+
+        if (ours == theirs || base == theirs)
+            continue; // our side already has the merged result
+        if (base == ours)
+            result.changes.push_back({entry.path, {ours, theirs}});
+        else
+            result.conflicts.push_back(entry.path);
+    }
+    return result;
+}
+
+/**
+ * @brief Merges two commits without touching the working tree, index or refs.
+ *
+ * Prints the hash of the merged tree (which is written to the object store), or
+ * the list of conflicting paths.
+ *
+ * @param our_ref First commit: a branch, or a full or abbreviated hash.
+ * @param their_ref Second commit.
+ */
+void mergeTree(const string &our_ref, const string &their_ref)
+{
+    string our_commit = resolveCommitish(our_ref);
+    string their_commit = resolveCommitish(their_ref);
+    if (our_commit.empty() || their_commit.empty())
+    {
+        cerr << "Error: No such commit.\n";
+        return;
+    }
+
+    string base_commit = find_common_ancestor(our_commit, their_commit);
+    TreeMergeResult result = mergeTrees(treeHashOf(base_commit), treeHashOf(our_commit), treeHashOf(their_commit));
+    if (!result.conflicts.empty())
+    {
+        for (const auto &path : result.conflicts)
+            cout << "CONFLICT: " << path << "\n";
+        return;
+    }
+    try
+    {
+        cout << writeTreeWithChanges(treeHashOf(our_commit), result.changes) << "\n";
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Failed to write merged tree: " << e.what() << "\n";
+    }
+}
+
 // The full merge operation
 void merge(const string &target_branch)
 {
-    string head_ref = readFile(".minigit/HEAD");
+    string head_ref = readFile(gitPath("HEAD"));
     if (head_ref.rfind("ref: ", 0) != 0)
     {
         cout << "Detached HEAD. Cannot merge in this state.\n";
@@ -150,10 +220,10 @@ void merge(const string &target_branch)
     string current_branch = head_ref.substr(5);
     current_branch.erase(current_branch.find_last_not_of(" \n\r\t") + 1); // Trim whitespace
 
-    string head_commit = readFile(".minigit/" + current_branch);
+    string head_commit = readFile(commonPath(current_branch));
     head_commit.erase(head_commit.find_last_not_of(" \n\r\t") + 1);
 
-    string target_commit = readFile(".minigit/refs/heads/" + target_branch);
+    string target_commit = readFile(commonPath("refs/heads/" + target_branch));
     target_commit.erase(target_commit.find_last_not_of(" \n\r\t") + 1);
 
     if (target_commit.empty())
@@ -163,122 +233,77 @@ void merge(const string &target_branch)
     }
 
     string base_commit = find_common_ancestor(head_commit, target_commit);
-    auto base_tree = parse_tree(base_commit);
-    auto our_tree = parse_tree(head_commit);
-    auto their_tree = parse_tree(target_commit);
+    string head_tree = treeHashOf(head_commit);
+    TreeMergeResult result = mergeTrees(treeHashOf(base_commit), head_tree, treeHashOf(target_commit));
 
-    map<string, string> result_tree;
-    set<string> all_paths;
-
-    for (const auto &[f, _] : base_tree)
-        all_paths.insert(f);
-    for (const auto &[f, _] : our_tree)
-        all_paths.insert(f);
-    for (const auto &[f, _] : their_tree)
-        all_paths.insert(f);
-
-    bool conflict = false;
-    map<string, string> files_to_write;
-
-    for (const auto &path : all_paths)
+    if (!result.conflicts.empty())
     {
-        string base = base_tree.count(path) ? base_tree[path] : "";
-        string ours = our_tree.count(path) ? our_tree[path] : "";
-        string theirs = their_tree.count(path) ? their_tree[path] : "";
-
-        if (ours == theirs)
-        {
-            if (!ours.empty())
-                result_tree[path] = ours;
-        }
-        else if (base == ours)
-        {
-            result_tree[path] = theirs;
-        }
-        else if (base == theirs)
-        {
-            result_tree[path] = ours;
-        }
-        else
-        {
+        for (const auto &path : result.conflicts)
             cout << "CONFLICT: " << path << "\n";
-            conflict = true;
-            continue;
-        }
-
-        files_to_write[path] = result_tree[path];
-    }
-
-    if (conflict)
-    {
         cout << "Automatic merge failed. Resolve conflicts and commit manually.\n";
         return;
     }
 
-    // Only write files and index if no conflicts
-    ofstream index_out(".minigit/index");
-    for (const auto &[path, hash] : files_to_write)
+    string tree_hash, commit_hash;
+    try
     {
-        ifstream blob(".minigit/objects/" + hash, ios::binary);
-        if (!blob)
-        {
-            cerr << "Missing blob: " << hash << "\n";
-            continue;
-        }
-        ofstream out_file(path, ios::binary);
-        if (!out_file)
-        {
-            cerr << "Failed to write file: " << path << "\n";
-            continue;
-        }
-        out_file << blob.rdbuf();
-        index_out << path << " " << hash << "\n";
+        tree_hash = writeTreeWithChanges(head_tree, result.changes);
+        commit_hash = writeCommitObject(tree_hash, {head_commit, target_commit}, "Merged branch " + target_branch);
     }
-    index_out.close();
-
-    // Step 5: Create new tree and commit
-    stringstream tree_content;
-    for (const auto &[path, hash] : result_tree)
-        tree_content << "tree " << hash << " " << path << "\n";
-
-    string tree_hash = generateHash(tree_content.str());
-    ofstream tree_file(".minigit/objects/" + tree_hash);
-    if (!tree_file)
+    catch (const runtime_error &e)
     {
-        cerr << "Failed to write tree object.\n";
+        cerr << "Failed to write merge objects: " << e.what() << "\n";
         return;
     }
-    tree_file << tree_content.str();
 
-    stringstream commit_content;
-    commit_content << "tree " << tree_hash << "\n";
-    commit_content << "parent " << head_commit;
-    commit_content << "\nparent " << target_commit << "\n";
-    commit_content << "author " << get_author_data() << "\n";
-    commit_content << "date " << get_timestamp() << "\n";
-    commit_content << "message Merged branch " << target_branch << "\n";
-
-    string commit_str = commit_content.str();
-    string commit_hash = generateHash(commit_str);
-    ofstream commit_file(".minigit/objects/" + commit_hash);
-    if (!commit_file)
+    // Only files whose blob changed relative to our side are rewritten, before the
+    // branch moves: if writing fails, the files already written are put back and
+    // the branch still matches the working tree.
+    try
     {
-        cerr << "Failed to write commit object.\n";
+        updateWorkingTree(result.changes);
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Error updating working tree: " << e.what() << "\n";
+        vector<TreeEntryDiff> undo;
+        for (const auto &change : result.changes)
+            undo.push_back({change.path, {change.hashes[1], change.hashes[0]}});
+        try
+        {
+            updateWorkingTree(undo);
+            cerr << "Merge aborted; the branch and working tree are unchanged.\n";
+        }
+        catch (const runtime_error &restoreError)
+        {
+            cerr << "Error restoring working tree: " << restoreError.what() << "\n"
+                 << "The branch is unchanged; run checkout with --force to restore the working tree.\n";
+        }
         return;
     }
-    commit_file << commit_str;
 
     // Update HEAD
-    ofstream branch_out(".minigit/" + current_branch);
+    ofstream branch_out(commonPath(current_branch));
     if (!branch_out)
     {
         cerr << "Failed to update branch ref.\n";
         return;
     }
     branch_out << commit_hash;
+    branch_out.close();
 
-    ofstream clear_index(".minigit/index");
-    clear_index.close();
+    // The index holds changes staged over HEAD, so once HEAD is the merge commit an
+    // empty index is the merged tree; stale staged entries must not be laid over it
+    try
+    {
+        clearIndex();
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Error: " << e.what() << "\n";
+        return;
+    }
 
     cout << "Merge successful. New commit: " << commit_hash << "\n";
+    reportPeakMemory("merge");
 }
@@ -0,0 +1,287 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <algorithm>
+#include <ctime>
+#include <cctype>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// object-index (next to the refs, not inside objects/) lists every object the
+// repository can read, loose, packed or in an alternate, sorted by hash:
+//   stamp <mtime in ns of each objects directory and its pack directory>\n
+//   256 fan-out lines, <8 hex number of hashes whose first byte is <= i>\n
+//   <40 hex hash>\n for every object
+// Objects are only ever added or removed as directory entries, which bumps the
+// directory's mtime, so the index is rebuilt whenever the stamp no longer matches.
+// Directory times are coarse, so as in git's racy-index check an index built
+// within a second of the last change is not trusted or saved.
+const size_t INDEX_FANOUT_LINE = 8 + 1;
+const long long RACY_NANOSECONDS = 1000000000LL;
+const size_t INDEX_HASH_LINE = 40 + 1;
+
+struct ObjectIndex
+{
+    bool loaded = false;
+    string stamp;
+    string owned; // the index content when it was rebuilt rather than mapped
+    const char *hashes = nullptr;
+    size_t count = 0;
+    array<size_t, 256> fanout = {};
+};
+
+static mutex indexLock;
+static ObjectIndex objectIndex;
+
+static vector<string> objectDirectories()
+{
+    vector<string> dirs = {commonPath("objects")};
+    for (const auto &alternate : objectAlternates())
+        dirs.push_back(alternate);
+    return dirs;
+}
+
+// The stamp of the object directories; racy is set when one changed too recently to tell later changes apart
+static string currentStamp(bool &racy)
+{
+    string stamp = "stamp";
+    long long newest = 0;
+    for (const auto &dir : objectDirectories())
+    {
+        for (const string &path : {dir, dir + "/pack"})
+        {
+            struct stat st;
+            long long ns = stat(path.c_str(), &st) == 0 ? st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec : 0;
+            newest = max(newest, ns);
+            stamp += " " + to_string(ns);
+        }
+    }
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    racy = now.tv_sec * 1000000000LL + now.tv_nsec - newest < RACY_NANOSECONDS;
+    return stamp;
+}
+
+static bool isHash(const string &name)
+{
+    return name.size() == 40 && name.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+// Points the index at its fan-out table and hash lines; false if the body is malformed
+static bool parseIndexBody(ObjectIndex &index, const char *body, size_t size)
+{
+    if (size < 256 * INDEX_FANOUT_LINE)
+        return false;
+    // A truncated or corrupt index is rebuilt, so every field is checked rather than trusted
+    for (size_t i = 0; i < 256; ++i)
+    {
+        const char *line = body + i * INDEX_FANOUT_LINE;
+        size_t count = 0;
+        for (size_t j = 0; j < 8; ++j)
+        {
+            int digit = isdigit((unsigned char)line[j]) ? line[j] - '0' : line[j] >= 'a' && line[j] <= 'f' ? line[j] - 'a' + 10 : -1;
+            if (digit < 0)
+                return false;
+            count = count * 16 + digit;
+        }
+        if (line[8] != '\n' || (i > 0 && count < index.fanout[i - 1]))
+            return false;
+        index.fanout[i] = count;
+    }
+    index.hashes = body + 256 * INDEX_FANOUT_LINE;
+    index.count = (size - 256 * INDEX_FANOUT_LINE) / INDEX_HASH_LINE;
+    return index.count == index.fanout[255] && (size - 256 * INDEX_FANOUT_LINE) % INDEX_HASH_LINE == 0;
+}
+
+static bool mapIndexFile(ObjectIndex &index, const string &stamp)
+{
+    int fd = open(commonPath("object-index").c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const char *data = static_cast<const char *>(mapping);
+    string_view content(data, st.st_size);
+    size_t headerEnd = content.find('\n');
+    if (headerEnd == string_view::npos || content.substr(0, headerEnd) != stamp ||
+        !parseIndexBody(index, data + headerEnd + 1, st.st_size - headerEnd - 1))
+    {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    return true; // the mapping lives as long as the process
+}
+
+// Lists every readable object and, unless the stamp is racy, saves the index; saving is best effort
+static void rebuildIndex(ObjectIndex &index, const string &stamp, bool racy)
+{
+    vector<string> hashes;
+    for (const auto &dir : objectDirectories())
+    {
+        error_code ec;
+        for (const auto &entry : fs::directory_iterator(dir, ec))
+        {
+            string name = entry.path().filename().string();
+            if (isHash(name))
+                hashes.push_back(name);
+        }
+        for (auto &hash : listPackedObjects(dir))
+            hashes.push_back(move(hash));
+    }
+    sort(hashes.begin(), hashes.end());
+    hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+
+    array<size_t, 256> counts = {};
+    for (const auto &hash : hashes)
+        counts[stoi(hash.substr(0, 2), nullptr, 16)]++;
+    string body;
+    body.reserve(256 * INDEX_FANOUT_LINE + hashes.size() * INDEX_HASH_LINE);
+    char line[INDEX_FANOUT_LINE + 1];
+    size_t total = 0;
+    for (size_t i = 0; i < 256; ++i)
+    {
+        total += counts[i];
+        snprintf(line, sizeof(line), "%08zx\n", total);
+        body += line;
+    }
+    for (const auto &hash : hashes)
+        body += hash + "\n";
+
+    string path = commonPath("object-index");
+    try
+    {
+        if (!racy)
+        {
+            writeFile(path + ".tmp", stamp + "\n" + body);
+            fs::rename(path + ".tmp", path);
+        }
+    }
+    catch (const exception &e)
+    {
+        // A read-only repository just rebuilds the index in memory each time
+    }
+    index.owned = move(body);
+}
+
+// The index, loaded on first use; reload rebuilds it unless it is known to be current
+static const ObjectIndex &loadObjectIndex(bool reload)
+{
+    bool racy = false;
+    if (objectIndex.loaded && (!reload || (objectIndex.stamp == currentStamp(racy) && !racy)))
+        return objectIndex;
+    ObjectIndex index;
+    index.stamp = currentStamp(racy);
+    if (racy || !mapIndexFile(index, index.stamp))
+        rebuildIndex(index, index.stamp, racy);
+    index.loaded = true;
+    objectIndex = move(index);
+    // A rebuilt index points into its own buffer, so it is parsed once it has moved
+    if (!objectIndex.owned.empty())
+        parseIndexBody(objectIndex, objectIndex.owned.data(), objectIndex.owned.size());
+    return objectIndex;
+}
+
+// Range of index positions whose hashes may start with prefix
+static pair<size_t, size_t> bucketOf(const ObjectIndex &index, const string &prefix)
+{
+    if (prefix.size() < 2)
+        return {0, index.count};
+    int first = stoi(prefix.substr(0, 2), nullptr, 16);
+    return {first ? index.fanout[first - 1] : 0, index.fanout[first]};
+}
+
+static size_t lowerBound(const ObjectIndex &index, const string &key)
+{
+    auto [lo, hi] = bucketOf(index, key);
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (string_view(index.hashes + mid * INDEX_HASH_LINE, 40) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static vector<string> searchIndex(const ObjectIndex &index, const string &prefix, size_t limit)
+{
+    vector<string> matches;
+    for (size_t i = lowerBound(index, prefix); i < index.count && matches.size() < limit; ++i)
+    {
+        string_view hash(index.hashes + i * INDEX_HASH_LINE, 40);
+        if (hash.compare(0, prefix.size(), prefix) != 0)
+            break;
+        matches.emplace_back(hash);
+    }
+    return matches;
+}
+
+/**
+ * @brief Finds the objects whose hash starts with a prefix.
+ *
+ * Uses the object index, so this is a binary search within one fan-out bucket
+ * rather than a scan of the object directories. A prefix with no match rechecks
+ * that the index is current, so objects written since it was loaded are found.
+ *
+ * @param prefix Lowercase hex digits.
+ * @param limit Stop after this many matches; 2 is enough to detect ambiguity.
+ */
+vector<string> objectsWithPrefix(const string &prefix, size_t limit)
+{
+    if (prefix.empty() || prefix.size() > 40 || prefix.find_first_not_of("0123456789abcdef") != string::npos)
+        return {};
+    lock_guard<mutex> guard(indexLock);
+    vector<string> matches = searchIndex(loadObjectIndex(false), prefix, limit);
+    if (matches.empty())
+        matches = searchIndex(loadObjectIndex(true), prefix, limit);
+    return matches;
+}
+
+/**
+ * @brief Shortens a hash to the fewest characters that identify it uniquely.
+ *
+ * @param minLength The abbreviation is never shorter than this.
+ */
+string abbreviateHash(const string &hash, size_t minLength)
+{
+    if (!isHash(hash))
+        return hash.substr(0, minLength);
+    lock_guard<mutex> guard(indexLock);
+    const ObjectIndex &index = loadObjectIndex(false);
+
+    // Only the neighbours in sorted order can share a longer prefix
+    size_t position = lowerBound(index, hash);
+    size_t shared = 0;
+    auto commonLength = [&](size_t i)
+    {
+        string_view other(index.hashes + i * INDEX_HASH_LINE, 40);
+        size_t n = 0;
+        while (n < 40 && other[n] == hash[n])
+            n++;
+        return n;
+    };
+    if (position > 0)
+        shared = max(shared, commonLength(position - 1));
+    size_t next = position < index.count && string_view(index.hashes + position * INDEX_HASH_LINE, 40) == hash ? position + 1 : position;
+    if (next < index.count)
+        shared = max(shared, commonLength(next));
+    return hash.substr(0, min<size_t>(40, max(minLength, shared + 1)));
+}
@@ -0,0 +1,529 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <ctime>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Packs live in objects/pack. pack-<id>.pack is the raw objects back to back;
+// pack-<id>.idx has one fixed-width record per object, sorted by hash:
+//   <40 hex hash> <16 hex offset> <16 hex size>\n
+// so a lookup is a binary search over the mapped index. The .idx is written last,
+// so a pack is only visible once it is complete.
+const size_t PACK_RECORD_SIZE = 40 + 1 + 16 + 1 + 16 + 1;
+const size_t OBJECT_CHUNK = 1 << 20;
+
+struct PackIndex
+{
+    string packPath;
+    const char *records = nullptr;
+    size_t count = 0;
+};
+
+// The packs of each objects directory, with the pack directory's mtime when it was
+// scanned. Lookups search an immutable snapshot without taking packLock; a miss
+// rescans only the pack directories whose mtime changed, and packLock serializes
+// building and publishing the next snapshot. Index mappings live for the process.
+struct PackDirectory
+{
+    vector<PackIndex> packs;
+    long long mtime = -1;
+};
+using PackSnapshot = map<string, PackDirectory>;
+
+static mutex packLock;
+static shared_ptr<const PackSnapshot> packSnapshot = make_shared<PackSnapshot>();
+
+// -1 while the directory changed too recently for its mtime to reveal a later change
+static long long packDirStamp(const string &objectsDir)
+{
+    struct stat st;
+    if (stat((objectsDir + "/pack").c_str(), &st) != 0)
+        return 0;
+    long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec - mtime < 1000000000LL ? -1 : mtime;
+}
+
+// Maps the indexes in objectsDir/pack that packs does not already hold
+static void scanPackDir(const string &objectsDir, vector<PackIndex> &packs)
+{
+    string packDir = objectsDir + "/pack";
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(packDir, ec))
+    {
+        string idxPath = entry.path().string();
+        if (entry.path().extension() != ".idx")
+            continue;
+        string packPath = idxPath.substr(0, idxPath.size() - 4) + ".pack";
+        if (any_of(packs.begin(), packs.end(), [&](const PackIndex &p)
+                   { return p.packPath == packPath; }))
+            continue;
+
+        int fd = open(idxPath.c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        struct stat st;
+        PackIndex pack;
+        pack.packPath = packPath;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                pack.records = static_cast<const char *>(mapping);
+                pack.count = st.st_size / PACK_RECORD_SIZE;
+            }
+        }
+        close(fd);
+        packs.push_back(pack);
+    }
+}
+
+// The current snapshot, first rescanning any of dirs whose pack directory changed
+static shared_ptr<const PackSnapshot> refreshPacks(const vector<string> &dirs)
+{
+    vector<long long> stamps;
+    for (const auto &dir : dirs)
+        stamps.push_back(packDirStamp(dir));
+    auto stale = [&](const PackSnapshot &snapshot)
+    {
+        for (size_t i = 0; i < dirs.size(); ++i)
+        {
+            auto it = snapshot.find(dirs[i]);
+            if (it == snapshot.end() || stamps[i] == -1 || it->second.mtime != stamps[i])
+                return true;
+        }
+        return false;
+    };
+    shared_ptr<const PackSnapshot> current = atomic_load(&packSnapshot);
+    if (!stale(*current))
+        return current;
+
+    lock_guard<mutex> guard(packLock);
+    current = atomic_load(&packSnapshot);
+    auto updated = make_shared<PackSnapshot>(*current);
+    for (size_t i = 0; i < dirs.size(); ++i)
+    {
+        PackDirectory &entry = (*updated)[dirs[i]];
+        if (entry.mtime == stamps[i] && stamps[i] != -1)
+            continue;
+        scanPackDir(dirs[i], entry.packs);
+        entry.mtime = stamps[i];
+    }
+    atomic_store(&packSnapshot, shared_ptr<const PackSnapshot>(updated));
+    return updated;
+}
+
+static bool searchPack(const PackIndex &pack, const string &hash, ObjectLocation &location)
+{
+    size_t lo = 0, hi = pack.count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *record = pack.records + mid * PACK_RECORD_SIZE;
+        int cmp = string_view(record, 40).compare(hash);
+        if (cmp == 0)
+        {
+            location.path = pack.packPath;
+            location.offset = stoull(string(record + 41, 16), nullptr, 16);
+            location.size = stoull(string(record + 58, 16), nullptr, 16);
+            location.packed = true;
+            return true;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+static bool searchPacks(const PackSnapshot &snapshot, const vector<string> &dirs, const string &hash, ObjectLocation &location)
+{
+    for (const auto &dir : dirs)
+    {
+        auto it = snapshot.find(dir);
+        if (it == snapshot.end())
+            continue;
+        for (const auto &pack : it->second.packs)
+        {
+            if (searchPack(pack, hash, location))
+                return true;
+        }
+    }
+    return false;
+}
+
+static bool findPacked(const vector<string> &dirs, const string &hash, ObjectLocation &location)
+{
+    shared_ptr<const PackSnapshot> snapshot = atomic_load(&packSnapshot);
+    if (searchPacks(*snapshot, dirs, hash, location))
+        return true;
+    // A pack written by a concurrent repack is picked up by the rescan
+    shared_ptr<const PackSnapshot> refreshed = refreshPacks(dirs);
+    return refreshed != snapshot && searchPacks(*refreshed, dirs, hash, location);
+}
+
+static bool findPacked(const string &hash, ObjectLocation &location)
+{
+    vector<string> dirs = {commonPath("objects")};
+    for (const auto &alternate : objectAlternates())
+        dirs.push_back(alternate);
+    return findPacked(dirs, hash, location);
+}
+
+static bool locateLocal(const string &hash, ObjectLocation &location)
+{
+    if (hash.empty())
+        return false;
+    string loose = objectPath(hash);
+    struct stat st;
+    if (stat(loose.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        location.path = loose;
+        location.offset = 0;
+        location.size = st.st_size;
+        location.packed = false;
+        return true;
+    }
+    return findPacked(hash, location);
+}
+
+/**
+ * @brief Finds where an object's bytes are stored.
+ *
+ * Loose objects (local or in an alternate) are preferred; otherwise the pack
+ * indexes are searched. A partial repository then fetches the object from its
+ * promisor remote.
+ *
+ * @return false if the object is not in any store.
+ */
+bool locateObject(const string &hash, ObjectLocation &location)
+{
+    if (locateLocal(hash, location))
+        return true;
+    return fetchPromisedObjects({hash}) > 0 && locateLocal(hash, location);
+}
+
+// Whether an object is stored locally; unlike reading it, this never fetches a promised object
+bool objectExists(const string &hash)
+{
+    ObjectLocation location;
+    return locateLocal(hash, location);
+}
+
+// Finds an object in one given object store, ignoring its alternates and promisor
+bool locateObjectIn(const string &objectsDir, const string &hash, ObjectLocation &location)
+{
+    struct stat st;
+    string loose = objectsDir + "/" + hash;
+    if (stat(loose.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        location = {loose, 0, (uintmax_t)st.st_size, false};
+        return true;
+    }
+    return findPacked({objectsDir}, hash, location);
+}
+
+static bool readRange(const ObjectLocation &location, string &content)
+{
+    int fd = open(location.path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    content.resize(location.size);
+    size_t done = 0;
+    while (done < location.size)
+    {
+        ssize_t n = pread(fd, content.data() + done, location.size - done, location.offset + done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+    return done == location.size;
+}
+
+/**
+ * @brief Looks an object up again after its located file could not be read.
+ *
+ * Maintenance packs loose objects and then removes them, so a loose object found
+ * just before that happened is now only in a pack.
+ *
+ * @return true if location now points at the object in a pack.
+ */
+bool relocateObject(const string &hash, ObjectLocation &location)
+{
+    return !location.packed && findPacked(hash, location);
+}
+
+// Opens the file holding an object, looking it up again if it was just packed
+static int openObject(const string &hash, ObjectLocation &location)
+{
+    int fd = open(location.path.c_str(), O_RDONLY);
+    if (fd < 0 && relocateObject(hash, location))
+        fd = open(location.path.c_str(), O_RDONLY);
+    return fd;
+}
+
+static bool readObjectInto(const string &hash, string &content)
+{
+    ObjectLocation location;
+    if (!locateObject(hash, location))
+        return false;
+    return readRange(location, content) || (relocateObject(hash, location) && readRange(location, content));
+}
+
+// Contents of an object wherever it is stored; empty if it does not exist
+string readObject(const string &hash)
+{
+    string content;
+    return readObjectInto(hash, content) ? content : "";
+}
+
+// Contents of an object in one given object store; empty if it is not there
+string readObjectFrom(const string &objectsDir, const string &hash)
+{
+    ObjectLocation location;
+    string content;
+    if (locateObjectIn(objectsDir, hash, location) && readRange(location, content))
+        return content;
+    return "";
+}
+
+/**
+ * @brief Reads many objects, batching the loose ones through readFilesBatch and
+ * fetching any promised ones in a single request.
+ *
+ * Loose objects whose read fails, e.g. because maintenance packed and removed
+ * them meanwhile, are looked up again and read one by one.
+ *
+ * @param hashes Objects to read.
+ * @param failed If given, set to one flag per hash telling whether it could not be read.
+ * @return The contents, in the same order as hashes; empty for failed reads.
+ */
+vector<string> readObjectsBatch(const vector<string> &hashes, vector<bool> *failed)
+{
+    vector<string> contents(hashes.size());
+    vector<ObjectLocation> locations(hashes.size());
+    vector<bool> found(hashes.size());
+    vector<string> missing;
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        found[i] = locateLocal(hashes[i], locations[i]);
+        if (!found[i] && !hashes[i].empty())
+            missing.push_back(hashes[i]);
+    }
+    if (!missing.empty() && fetchPromisedObjects(missing) > 0)
+    {
+        for (size_t i = 0; i < hashes.size(); ++i)
+        {
+            if (!found[i])
+                found[i] = locateLocal(hashes[i], locations[i]);
+        }
+    }
+
+    vector<string> loosePaths;
+    vector<size_t> looseOwners, slow;
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        const ObjectLocation &location = locations[i];
+        if (!found[i])
+            continue;
+        if (location.packed)
+            slow.push_back(i);
+        else
+        {
+            loosePaths.push_back(location.path);
+            looseOwners.push_back(i);
+        }
+    }
+
+    vector<bool> looseFailed;
+    vector<string> loose = readFilesBatch(loosePaths, &looseFailed);
+    for (size_t i = 0; i < looseOwners.size(); ++i)
+    {
+        if (looseFailed[i])
+            slow.push_back(looseOwners[i]);
+        else
+            contents[looseOwners[i]] = move(loose[i]);
+    }
+    vector<char> read(slow.size());
+    parallelFor(slow.size(), [&](size_t i)
+                { read[i] = readObjectInto(hashes[slow[i]], contents[slow[i]]); });
+
+    if (failed)
+    {
+        failed->assign(hashes.size(), false);
+        for (size_t i = 0; i < hashes.size(); ++i)
+            (*failed)[i] = !found[i];
+        for (size_t i = 0; i < slow.size(); ++i)
+            (*failed)[slow[i]] = !read[i];
+    }
+    for (size_t i = 0; i < slow.size(); ++i)
+    {
+        if (!read[i])
+            contents[slow[i]].clear();
+    }
+    return contents;
+}
+
+// Hashes of every object in the packs of an objects directory; this repository's by default
+vector<string> listPackedObjects(const string &objectsDir)
+{
+    vector<string> hashes;
+    string dir = objectsDir.empty() ? commonPath("objects") : objectsDir;
+    shared_ptr<const PackSnapshot> snapshot = refreshPacks({dir});
+    for (const auto &pack : snapshot->at(dir).packs)
+    {
+        for (size_t i = 0; i < pack.count; ++i)
+            hashes.emplace_back(pack.records + i * PACK_RECORD_SIZE, 40);
+    }
+    return hashes;
+}
+
+/**
+ * @brief Moves loose objects into a new pack.
+ *
+ * Objects are appended to the pack in the order given until maxBytes have been
+ * written or the deadline passes. The pack and then its index are renamed into
+ * place, and only then are the packed loose files deleted, so every object stays
+ * readable throughout.
+ *
+ * @return The number of objects packed.
+ */
+size_t packLooseObjects(const vector<string> &hashes, uintmax_t maxBytes, chrono::steady_clock::time_point deadline)
+{
+    if (hashes.empty())
+        return 0;
+    string packDir = commonPath("objects/pack");
+    fs::create_directories(packDir);
+    string tempPack = packDir + "/tmp-" + to_string(getpid()) + ".pack";
+    ofstream pack(tempPack, ios::binary);
+    if (!pack)
+        return 0;
+
+    vector<pair<string, pair<uintmax_t, uintmax_t>>> records; // hash -> offset, size
+    uintmax_t offset = 0;
+    for (const auto &hash : hashes)
+    {
+        if (offset >= maxBytes || chrono::steady_clock::now() > deadline)
+            break;
+        string loose = commonPath("objects/" + hash);
+        ifstream object(loose, ios::binary);
+        if (!object)
+            continue;
+        string content((istreambuf_iterator<char>(object)), istreambuf_iterator<char>());
+        pack << content;
+        records.push_back({hash, {offset, content.size()}});
+        offset += content.size();
+    }
+    pack.close();
+    if (!pack || records.empty())
+    {
+        fs::remove(tempPack);
+        return 0;
+    }
+
+    sort(records.begin(), records.end());
+    string index;
+    char record[PACK_RECORD_SIZE + 1];
+    for (const auto &[hash, range] : records)
+    {
+        snprintf(record, sizeof(record), "%s %016llx %016llx\n", hash.c_str(),
+                 (unsigned long long)range.first, (unsigned long long)range.second);
+        index += record;
+    }
+
+    string name = packDir + "/pack-" + generateHash(index);
+    try
+    {
+        fs::rename(tempPack, name + ".pack");
+        writeFile(name + ".idx.tmp", index);
+        fs::rename(name + ".idx.tmp", name + ".idx");
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error writing pack: " << e.what() << "\n";
+        fs::remove(tempPack);
+        return 0;
+    }
+
+    for (const auto &[hash, _] : records)
+        fs::remove(commonPath("objects/" + hash));
+    return records.size();
+}
+
+// Copies an object into a file in fixed-size chunks, whatever its size
+bool copyObjectToFile(const string &hash, const string &path)
+{
+    ObjectLocation location;
+    if (!locateObject(hash, location))
+        return false;
+    int in = openObject(hash, location);
+    if (in < 0)
+        return false;
+    fs::path parent = fs::path(path).parent_path();
+    if (!parent.empty())
+        fs::create_directories(parent);
+    ofstream out(path, ios::binary | ios::trunc);
+    vector<char> buffer(max<uintmax_t>(1, min<uintmax_t>(OBJECT_CHUNK, location.size)));
+    uintmax_t done = 0;
+    while (out && done < location.size)
+    {
+        ssize_t n = pread(in, buffer.data(), min<uintmax_t>(buffer.size(), location.size - done), location.offset + done);
+        if (n <= 0)
+            break;
+        out.write(buffer.data(), n);
+        done += n;
+    }
+    close(in);
+    out.close();
+    return out && done == location.size;
+}
+
+// Whether a file holds exactly an object's bytes; sizes are compared first and
+// contents only chunk by chunk
+bool fileMatchesObject(const string &path, const string &hash)
+{
+    ObjectLocation location;
+    struct stat st;
+    if (!locateObject(hash, location) || stat(path.c_str(), &st) != 0 || (uintmax_t)st.st_size != location.size)
+        return false;
+    int file = open(path.c_str(), O_RDONLY);
+    int object = openObject(hash, location);
+    bool same = file >= 0 && object >= 0;
+    // Most tracked files are small, so the buffers are sized to the file, not the chunk
+    size_t chunk = max<uintmax_t>(1, min<uintmax_t>(OBJECT_CHUNK, location.size));
+    vector<char> a(chunk), b(chunk);
+    for (uintmax_t done = 0; same && done < location.size;)
+    {
+        size_t want = min<uintmax_t>(chunk, location.size - done);
+        ssize_t n = pread(file, a.data(), want, done);
+        ssize_t m = pread(object, b.data(), want, location.offset + done);
+        same = n == (ssize_t)want && m == (ssize_t)want && memcmp(a.data(), b.data(), want) == 0;
+        done += want;
+    }
+    if (file >= 0)
+        close(file);
+    if (object >= 0)
+        close(object);
+    return same;
+}
@@ -0,0 +1,313 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "helpers.hpp"
+#include "commands.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// A partial repository has "promisorRemote = <server>" in its config and may
+// lack blobs, which the server promises to supply. The server is either another
+// repository's object store (a directory) or "unix:<socket>", a serve-objects
+// daemon. Over the socket the client sends
+//   want <hash>\n ... done\n
+// and the daemon answers every want, in order, with
+//   object <hash> <size>\n<size bytes>   or   missing <hash>\n
+// Fetched objects are checked against their hash and stored as loose objects.
+const string SOCKET_PREFIX = "unix:";
+
+static mutex fetchLock;
+static unordered_set<string> unavailable; // asked for before and not supplied
+
+// The promisor remote of this repository; empty unless it is a partial repository
+string promisorRemote()
+{
+    return get_config_value("promisorRemote");
+}
+
+static bool storeFetchedObject(const string &hash, const string &content)
+{
+    if (generateHash(content) != hash)
+    {
+        cerr << "Error: promisor remote sent a corrupt object " << hash << "\n";
+        return false;
+    }
+    string path = commonPath("objects/" + hash);
+    try
+    {
+        writeFile(path + ".fetch", content);
+        fs::rename(path + ".fetch", path);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error: could not store fetched object " << hash << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+static size_t fetchFromDirectory(const string &remote, const vector<string> &hashes, vector<string> &notFound)
+{
+    // Either an objects directory or the working tree of a repository
+    string objectsDir = fs::is_directory(remote + "/.minigit/objects") ? remote + "/.minigit/objects" : remote;
+    if (!fs::is_directory(objectsDir))
+    {
+        cerr << "Error: promisor remote " << remote << " is not an object store\n";
+        return 0;
+    }
+    size_t fetched = 0;
+    for (const auto &hash : hashes)
+    {
+        ObjectLocation location;
+        if (!locateObjectIn(objectsDir, hash, location))
+            notFound.push_back(hash);
+        else if (storeFetchedObject(hash, readObjectFrom(objectsDir, hash)))
+            fetched++;
+    }
+    return fetched;
+}
+
+static int connectSocket(const string &socketPath)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return -1;
+    socketPath.copy(address.sun_path, socketPath.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const string &data)
+{
+    for (size_t done = 0; done < data.size();)
+    {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Buffered reads of protocol lines and object bodies from a socket
+struct SocketReader
+{
+    int fd;
+    string buffer;
+    size_t start = 0;
+
+    explicit SocketReader(int fd) : fd(fd) {}
+
+    bool fill()
+    {
+        if (start > 0)
+        {
+            buffer.erase(0, start);
+            start = 0;
+        }
+        char chunk[1 << 16];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    bool readLine(string &line)
+    {
+        size_t end;
+        while ((end = buffer.find('\n', start)) == string::npos)
+        {
+            if (!fill())
+                return false;
+        }
+        line = buffer.substr(start, end - start);
+        start = end + 1;
+        return true;
+    }
+
+    bool readBytes(size_t size, string &data)
+    {
+        while (buffer.size() - start < size)
+        {
+            if (!fill())
+                return false;
+        }
+        data = buffer.substr(start, size);
+        start += size;
+        return true;
+    }
+};
+
+static size_t fetchFromSocket(const string &socketPath, const vector<string> &hashes, vector<string> &notFound)
+{
+    int fd = connectSocket(socketPath);
+    if (fd < 0)
+    {
+        cerr << "Error: could not connect to promisor remote " << SOCKET_PREFIX << socketPath << "\n";
+        return 0;
+    }
+    string request;
+    for (const auto &hash : hashes)
+        request += "want " + hash + "\n";
+    request += "done\n";
+
+    size_t fetched = 0;
+    SocketReader reader(fd);
+    string line, content;
+    if (sendAll(fd, request))
+    {
+        for (size_t i = 0; i < hashes.size() && reader.readLine(line); ++i)
+        {
+            if (line.rfind("missing ", 0) == 0)
+            {
+                notFound.push_back(line.substr(8));
+                continue;
+            }
+            // object <hash> <size>
+            size_t space = line.find(' ', 7);
+            if (line.rfind("object ", 0) != 0 || space == string::npos || space + 1 == line.size() ||
+                line.find_first_not_of("0123456789", space + 1) != string::npos)
+                break;
+            string hash = line.substr(7, space - 7);
+            if (!reader.readBytes(stoull(line.substr(space + 1)), content))
+                break;
+            if (storeFetchedObject(hash, content))
+                fetched++;
+        }
+    }
+    close(fd);
+    return fetched;
+}
+
+/**
+ * @brief Fetches objects this partial repository lacks from its promisor remote.
+ *
+ * Objects already present, and objects the remote failed to supply earlier in
+ * this process, are skipped; everything else is requested in one batch. Does
+ * nothing outside a partial repository.
+ *
+ * @return The number of objects fetched.
+ */
+size_t fetchPromisedObjects(const vector<string> &hashes)
+{
+    vector<string> wanted;
+    for (const auto &hash : hashes)
+    {
+        if (hash.size() == 40 && hash.find_first_not_of("0123456789abcdef") == string::npos)
+            wanted.push_back(hash);
+    }
+    if (wanted.empty())
+        return 0;
+    string remote = promisorRemote();
+    if (remote.empty())
+        return 0;
+
+    lock_guard<mutex> guard(fetchLock);
+    sort(wanted.begin(), wanted.end());
+    wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+    wanted.erase(remove_if(wanted.begin(), wanted.end(), [](const string &hash)
+                           { return unavailable.count(hash) || objectExists(hash); }),
+                 wanted.end());
+    if (wanted.empty())
+        return 0;
+
+    vector<string> notFound;
+    size_t fetched = remote.rfind(SOCKET_PREFIX, 0) == 0
+                         ? fetchFromSocket(remote.substr(SOCKET_PREFIX.size()), wanted, notFound)
+                         : fetchFromDirectory(remote, wanted, notFound);
+    if (fetched < wanted.size())
+    {
+        // Not asking again keeps a missing object from costing a round trip per read
+        for (const auto &hash : wanted)
+        {
+            if (!objectExists(hash))
+                unavailable.insert(hash);
+        }
+        for (const auto &hash : notFound)
+            cerr << "Error: promisor remote does not have object " << hash << "\n";
+    }
+    return fetched;
+}
+
+static void serveConnection(int fd)
+{
+    SocketReader reader(fd);
+    vector<string> wants;
+    string line;
+    while (reader.readLine(line) && line != "done")
+    {
+        if (line.rfind("want ", 0) == 0)
+            wants.push_back(line.substr(5));
+    }
+    for (const auto &hash : wants)
+    {
+        ObjectLocation location;
+        bool present = locateObject(hash, location);
+        string content = present ? readObject(hash) : "";
+        string reply = present ? "object " + hash + " " + to_string(content.size()) + "\n" + content : "missing " + hash + "\n";
+        if (!sendAll(fd, reply))
+            break;
+    }
+    close(fd);
+}
+
+/**
+ * @brief Serves this repository's objects to partial repositories over a Unix socket.
+ *
+ * Runs in the foreground until killed; each connection is handled on its own thread.
+ * Clients use it with "promisorRemote = unix:<socketPath>".
+ *
+ * @param socketPath Socket file to create; a stale one is replaced.
+ */
+void serveObjects(const string &socketPath)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Error: socket path too long: " << socketPath << "\n";
+        return;
+    }
+    socketPath.copy(address.sun_path, socketPath.size());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        cerr << "Error: could not listen on " << socketPath << "\n";
+        if (listener >= 0)
+            close(listener);
+        return;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Serving objects on " << socketPath << "\n"
+         << flush;
+    while (true)
+    {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0)
+            thread(serveConnection, fd).detach();
+    }
+}
@@ -0,0 +1,308 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+static string commitField(const string &commitContent, const string &field)
+{
+    istringstream lines(commitContent);
+    string line;
+    while (getline(lines, line))
+    {
+        if (line.rfind(field + " ", 0) == 0)
+            return line.substr(field.size() + 1);
+    }
+    return "";
+}
+
+static map<string, string> commitTree(const string &commitHash)
+{
+    if (commitHash.empty())
+        return {};
+    string treeHash = getTreeHashFromCommit(readObject(commitHash));
+    if (treeHash.empty())
+        return {};
+    return parseTreeObject(readObject(treeHash));
+}
+
+/**
+ * @brief Applies the change from base to theirs onto current, in place.
+ *
+ * Only paths that differ between base and theirs are visited in current, so every
+ * other entry (and its blob) is carried over untouched.
+ *
+ * @return The paths that current changed differently; current is left partially
+ * updated when this is non-empty.
+ */
+static vector<string> applyTreeDelta(const map<string, string> &base, const map<string, string> &theirs, map<string, string> &current)
+{
+    vector<string> conflicts;
+    auto apply = [&](const string &path, const string &from, const string &to)
+    {
+        auto it = current.find(path);
+        string ours = it == current.end() ? "" : it->second;
+        if (ours == to)
+            return;
+        if (ours != from)
+        {
+            conflicts.push_back(path);
+            return;
+        }
+        if (to.empty())
+            current.erase(it);
+        else
+            current[path] = to;
+    };
+
+    for (const auto &[path, hash] : theirs)
+    {
+        auto it = base.find(path);
+        if (it == base.end())
+            apply(path, "", hash);
+        else if (it->second != hash)
+            apply(path, it->second, hash);
+    }
+    for (const auto &[path, hash] : base)
+    {
+        if (theirs.count(path) == 0)
+            apply(path, hash, "");
+    }
+    return conflicts;
+}
+
+// Points the current branch (or a detached HEAD) at a new commit
+static void moveHead(const string &commitHash)
+{
+    string head = trim(readFile(gitPath("HEAD")));
+    if (head.rfind("ref: ", 0) == 0)
+        writeFile(commonPath(head.substr(5)), commitHash);
+    else
+        writeFile(gitPath("HEAD"), commitHash);
+}
+
+// Refuses when files are modified or changes are staged, since neither would survive
+static bool workingTreeClean(const map<string, string> &headTree)
+{
+    vector<string> stagedFiles;
+    for (const auto &[path, hash] : readIndexEntries())
+    {
+        auto committed = headTree.find(path);
+        if (committed == headTree.end() || committed->second != hash)
+            stagedFiles.push_back(path);
+    }
+    if (!stagedFiles.empty())
+    {
+        cerr << "Error: Cannot rewrite history with staged changes:\n";
+        for (const auto &file : stagedFiles)
+            cerr << "  " << file << "\n";
+        return false;
+    }
+    vector<string> modifiedFiles = getModifiedFiles(headTree);
+    if (modifiedFiles.empty())
+        return true;
+    cerr << "Error: Cannot rewrite history with modified tracked files:\n";
+    for (const auto &file : modifiedFiles)
+        cerr << "  " << file << "\n";
+    return false;
+}
+
+// Updates the working tree to the new tip and only then moves HEAD and clears the
+// index. If writing fails, the files already written are put back so the checkout
+// still matches HEAD.
+static bool switchToTip(const map<string, string> &headTree, const string &tip)
+{
+    map<string, string> tipTree = commitTree(tip);
+    try
+    {
+        updateWorkingTree(headTree, tipTree);
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Error updating working tree: " << e.what() << "\n";
+        try
+        {
+            updateWorkingTree(tipTree, headTree);
+            cerr << "HEAD and the working tree are unchanged; the rewritten commits end at " << tip << "\n";
+        }
+        catch (const runtime_error &restoreError)
+        {
+            cerr << "Error restoring working tree: " << restoreError.what() << "\n"
+                 << "HEAD is unchanged; run checkout with --force to restore the working tree.\n";
+        }
+        return false;
+    }
+    moveHead(tip);
+    // Staged entries matching the old HEAD would revert the replayed changes at the next commit
+    try
+    {
+        clearIndex();
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << "Error: " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Every commit reachable from tip, following parent links without reading any tree
+static unordered_set<string> ancestorCommits(const string &tip)
+{
+    unordered_set<string> seen = {tip};
+    vector<string> stack = {tip};
+    while (!stack.empty())
+    {
+        string commit = stack.back();
+        stack.pop_back();
+        for (const auto &parent : get_commit_parents(readObject(commit)))
+        {
+            if (seen.insert(parent).second)
+                stack.push_back(parent);
+        }
+    }
+    return seen;
+}
+
+/**
+ * @brief Replays commits onto a new base without touching the working tree
+ * until the end.
+ *
+ * Each commit's change against its first parent is applied in memory to the tree
+ * of the previously replayed commit, and the resulting tree and commit are written.
+ * The branch and working tree are only updated once every commit has been replayed;
+ * on a conflict nothing but unreferenced objects is left behind.
+ *
+ * @param onto Commit the first replayed commit gets as its parent.
+ * @param commits Commits to replay, oldest first.
+ * @return The new tip, or an empty string on conflict.
+ */
+static string replayCommits(const string &onto, const vector<string> &commits)
+{
+    string tip = onto;
+    map<string, string> current = commitTree(onto);
+    map<string, string> previousTree;
+    string previousCommit;
+
+    for (const auto &commit : commits)
+    {
+        string content = readObject(commit);
+        vector<string> parents = get_commit_parents(content);
+        string parent = parents.empty() ? "" : parents[0];
+
+        // In a linear stack the parent's tree is the tree parsed in the previous step
+        map<string, string> base = (parent == previousCommit && !previousCommit.empty()) ? move(previousTree) : commitTree(parent);
+        map<string, string> theirs = commitTree(commit);
+
+        vector<string> conflicts = applyTreeDelta(base, theirs, current);
+        if (!conflicts.empty())
+        {
+            cerr << "Could not apply " << commit << " (" << commitField(content, "message") << "):\n";
+            for (const auto &path : conflicts)
+                cerr << "CONFLICT: " << path << "\n";
+            return "";
+        }
+
+        string treeHash = writeTreeObject(current);
+        tip = writeCommitObject(treeHash, {tip}, commitField(content, "message"), commitField(content, "author"));
+        cout << "Applied " << abbreviateHash(commit) << " as " << abbreviateHash(tip) << "\n";
+
+        previousTree = move(theirs);
+        previousCommit = commit;
+    }
+    return tip;
+}
+
+/**
+ * @brief Applies the change introduced by a commit on top of HEAD.
+ *
+ * @param commitRef Branch or commit to pick.
+ */
+void cherryPick(const string &commitRef)
+{
+    string pick = resolveCommitish(commitRef);
+    string head = resolveCommitish("HEAD");
+    if (pick.empty())
+    {
+        cerr << "Error: No such branch or commit: " << commitRef << "\n";
+        return;
+    }
+    if (head.empty())
+    {
+        cerr << "Error: Cannot cherry-pick onto a branch with no commits yet.\n";
+        return;
+    }
+
+    map<string, string> headTree = commitTree(head);
+    if (!workingTreeClean(headTree))
+        return;
+
+    string tip = replayCommits(head, {pick});
+    if (tip.empty())
+        return;
+
+    if (!switchToTip(headTree, tip))
+        return;
+    cout << "Cherry-picked " << pick << " as " << tip << "\n";
+}
+
+/**
+ * @brief Moves the commits of HEAD that are not in upstream onto a new base.
+ *
+ * Like "rebase --onto <newbase> <upstream>": the first-parent chain from HEAD
+ * down to the first commit reachable from upstream is replayed, oldest first,
+ * on top of newbase. Merge commits in the range are dropped.
+ *
+ * @param newBase Branch or commit to rebase onto.
+ * @param upstream Branch or commit whose history is not replayed.
+ */
+void rebaseOnto(const string &newBase, const string &upstream)
+{
+    string onto = resolveCommitish(newBase);
+    string upstreamCommit = resolveCommitish(upstream);
+    string head = resolveCommitish("HEAD");
+    if (onto.empty() || upstreamCommit.empty())
+    {
+        cerr << "Error: No such branch or commit: " << (onto.empty() ? newBase : upstream) << "\n";
+        return;
+    }
+    if (head.empty())
+    {
+        cerr << "Error: Cannot rebase a branch with no commits yet.\n";
+        return;
+    }
+
+    map<string, string> headTree = commitTree(head);
+    if (!workingTreeClean(headTree))
+        return;
+
+    unordered_set<string> excluded = ancestorCommits(upstreamCommit);
+    vector<string> commits;
+    for (string commit = head; !commit.empty() && !excluded.count(commit);)
+    {
+        vector<string> parents = get_commit_parents(readObject(commit));
+        if (parents.size() <= 1)
+            commits.push_back(commit);
+        commit = parents.empty() ? "" : parents[0];
+    }
+    reverse(commits.begin(), commits.end());
+
+    string tip = replayCommits(onto, commits);
+    if (tip.empty())
+    {
+        cerr << "Rebase aborted; HEAD and the working tree are unchanged.\n";
+        return;
+    }
+
+    if (!switchToTip(headTree, tip))
+        return;
+    cout << "Successfully rebased " << commits.size() << " commits onto " << onto << "\n";
+}
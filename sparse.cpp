@@ -0,0 +1,228 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <filesystem>
+#include <fnmatch.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+struct SparsePatterns
+{
+    bool enabled = false;
+    bool cone = false;
+    unordered_set<string> coneDirs; // cone mode: directories included recursively
+    vector<string> patterns;        // pattern mode: fnmatch globs, "!" negates
+};
+
+static string normalizeDir(string dir)
+{
+    while (!dir.empty() && dir.back() == '/')
+        dir.pop_back();
+    while (dir.rfind("./", 0) == 0)
+        dir = dir.substr(2);
+    return dir;
+}
+
+// The sparse flags live in each worktree's own config.worktree, next to its
+// patterns, so enabling sparse checkout in one worktree leaves the others alone
+static string sparseConfigValue(const string &key)
+{
+    string configPath = gitPath("config.worktree");
+    // Repositories from before per-worktree flags kept them in the shared config,
+    // which only ever applied to the main worktree
+    if (!fileExists(configPath))
+        return gitDir() == commonDir() ? get_config_value(key) : "";
+
+    ifstream config(configPath);
+    string line;
+    string prefix = key + " = ";
+    while (getline(config, line))
+    {
+        if (line.find(prefix) == 0)
+            return trim(line.substr(prefix.size()));
+    }
+    return "";
+}
+
+static void setSparseConfig(bool enabled, bool cone)
+{
+    writeFile(gitPath("config.worktree"), string("sparseCheckout = ") + (enabled ? "true" : "false") + "\n" +
+                                              "sparseCheckoutCone = " + (cone ? "true" : "false") + "\n");
+    // Drop the legacy shared flags so they cannot leak into other worktrees
+    if (gitDir() == commonDir() && !get_config_value("sparseCheckout").empty())
+    {
+        set_config_value("sparseCheckout", "false");
+        set_config_value("sparseCheckoutCone", "false");
+    }
+}
+
+static SparsePatterns loadSparsePatterns()
+{
+    SparsePatterns sparse;
+    if (sparseConfigValue("sparseCheckout") != "true")
+        return sparse;
+
+    sparse.enabled = true;
+    sparse.cone = sparseConfigValue("sparseCheckoutCone") == "true";
+
+    ifstream file(gitPath("info/sparse-checkout"));
+    string line;
+    while (getline(file, line))
+    {
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (sparse.cone)
+            sparse.coneDirs.insert(normalizeDir(line));
+        else
+            sparse.patterns.push_back(line);
+    }
+    return sparse;
+}
+
+static bool matchesSparse(const SparsePatterns &sparse, const string &path)
+{
+    if (!sparse.enabled)
+        return true;
+
+    if (sparse.cone)
+    {
+        // Files at the top level are always present; otherwise one of the
+        // leading directories of the path must be a cone directory
+        size_t slash = path.find('/');
+        if (slash == string::npos)
+            return true;
+        while (slash != string::npos)
+        {
+            if (sparse.coneDirs.count(path.substr(0, slash)))
+                return true;
+            slash = path.find('/', slash + 1);
+        }
+        return false;
+    }
+
+    // Pattern mode: the last matching pattern decides
+    bool included = false;
+    for (const auto &pattern : sparse.patterns)
+    {
+        bool negate = pattern[0] == '!';
+        string glob = negate ? pattern.substr(1) : pattern;
+        bool matched;
+        if (!glob.empty() && glob.back() == '/')
+            matched = path.rfind(glob, 0) == 0;
+        else
+            matched = fnmatch(glob.c_str(), path.c_str(), 0) == 0 ||
+                      fnmatch((glob + "/*").c_str(), path.c_str(), 0) == 0;
+        if (matched)
+            included = !negate;
+    }
+    return included;
+}
+
+bool inSparseCheckout(const string &path)
+{
+    return matchesSparse(loadSparsePatterns(), path);
+}
+
+// Loads the patterns once for callers that test many paths one at a time
+function<bool(const string &)> sparseMatcher()
+{
+    SparsePatterns sparse = loadSparsePatterns();
+    return [sparse](const string &path)
+    { return matchesSparse(sparse, path); };
+}
+
+// Keeps only the entries of a tree that belong to the sparse checkout
+map<string, string> filterSparse(const map<string, string> &files)
+{
+    SparsePatterns sparse = loadSparsePatterns();
+    if (!sparse.enabled)
+        return files;
+
+    map<string, string> filtered;
+    for (const auto &[path, hash] : files)
+    {
+        if (matchesSparse(sparse, path))
+            filtered.emplace_hint(filtered.end(), path, hash);
+    }
+    return filtered;
+}
+
+// Brings the working tree in line with the current sparse patterns: tracked files
+// that left the sparse set are removed, files that entered it are written.
+static void reapplySparseCheckout()
+{
+    SparsePatterns sparse = loadSparsePatterns();
+    map<string, string> tracked = getCurrentTrackedFiles();
+    size_t written = 0, removed = 0;
+
+    for (const auto &[path, blobHash] : tracked)
+    {
+        bool wanted = matchesSparse(sparse, path);
+        if (wanted && !fileExists(path))
+        {
+            writeFile(path, readObject(blobHash));
+            written++;
+        }
+        else if (!wanted && fileExists(path))
+        {
+            if (readFile(path) != readObject(blobHash))
+            {
+                cerr << "Warning: keeping modified file outside sparse checkout: " << path << "\n";
+                continue;
+            }
+            fs::remove(path);
+            removed++;
+        }
+    }
+    cout << "Sparse checkout updated: " << written << " written, " << removed << " removed.\n";
+}
+
+/**
+ * @brief Restricts the working tree to the given sparse-checkout patterns.
+ *
+ * In cone mode each pattern is a directory that is included recursively, and files
+ * at the top level are always included. Otherwise patterns are shell globs matched
+ * against the full path, where a leading "!" excludes and the last match wins.
+ * The patterns are stored in .minigit/info/sparse-checkout and the mode in
+ * .minigit/config.worktree, both per worktree, and limit what checkout
+ * writes, what the dirty check reads, and what can be staged.
+ *
+ * @param patterns Directories (cone mode) or globs.
+ * @param cone Whether to use directory-prefix cone matching.
+ */
+void sparseCheckoutSet(const vector<string> &patterns, bool cone)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    stringstream content;
+    for (const auto &pattern : patterns)
+        content << (cone ? normalizeDir(pattern) : pattern) << "\n";
+    writeFile(gitPath("info/sparse-checkout"), content.str());
+
+    setSparseConfig(true, cone);
+    reapplySparseCheckout();
+}
+
+// Turns sparse checkout off and materializes every tracked file again
+void sparseCheckoutDisable()
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    setSparseConfig(false, false);
+    reapplySparseCheckout();
+}
@@ -0,0 +1,442 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <tuple>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Tree objects hold one "tree <blob hash> <path>" line per file, written in path
+// order, so two or three trees can be compared with a single merge-join pass over
+// their raw content. Trees written out of order are sorted once up front.
+//
+// Under a memory budget, a tree larger than its share of the budget is never
+// loaded: it is read from the object store a line at a time, and if it is out of
+// order it is first sorted on disk in budget-sized runs that are merged into a
+// spill file.
+
+const size_t TREE_STREAM_BUFFER = 1 << 16;
+
+static bool parseTreeLine(string_view line, string_view &path, string_view &hash)
+{
+    size_t first = line.find(' ');
+    if (first == string_view::npos)
+        return false;
+    size_t second = line.find(' ', first + 1);
+    if (second == string_view::npos)
+        return false;
+    hash = line.substr(first + 1, second - first - 1);
+    path = line.substr(second + 1);
+    while (!path.empty() && (path.back() == '\r' || path.back() == ' '))
+        path.remove_suffix(1);
+    return !path.empty();
+}
+
+static string spillFileName(const string &kind)
+{
+    static atomic<unsigned> counter{0};
+    fs::create_directories(commonPath("tmp"));
+    return commonPath("tmp/" + kind + "-" + to_string(getpid()) + "-" + to_string(counter++));
+}
+
+/**
+ * @brief Sorts a tree object that is too large to sort in memory.
+ *
+ * Lines are collected into runs of about runBytes, each run is sorted by path and
+ * written to its own file, and the runs are merged into one sorted file. As with
+ * parseTreeObject, the last line for a repeated path wins.
+ *
+ * @return The sorted file, which the caller removes.
+ */
+static string sortTreeOnDisk(const string &treeHash, ObjectLocation location, uintmax_t runBytes)
+{
+    ifstream in(location.path, ios::binary);
+    if (!in && relocateObject(treeHash, location))
+        in.open(location.path, ios::binary);
+    in.seekg(location.offset);
+    uintmax_t remaining = location.size;
+
+    vector<string> runFiles;
+    vector<pair<string, string>> run; // path, hash
+    uintmax_t runSize = 0;
+    auto flushRun = [&]()
+    {
+        if (run.empty())
+            return;
+        stable_sort(run.begin(), run.end(), [](const auto &a, const auto &b)
+                    { return a.first < b.first; });
+        runFiles.push_back(spillFileName("treesort-run"));
+        ofstream out(runFiles.back(), ios::binary);
+        for (size_t i = 0; i < run.size(); ++i)
+        {
+            if (i + 1 < run.size() && run[i + 1].first == run[i].first)
+                continue;
+            out << "tree " << run[i].second << " " << run[i].first << "\n";
+        }
+        run.clear();
+        runSize = 0;
+    };
+
+    string line;
+    string_view path, hash;
+    while (remaining > 0 && getline(in, line))
+    {
+        remaining -= min<uintmax_t>(remaining, line.size() + 1);
+        if (!parseTreeLine(line, path, hash))
+            continue;
+        run.emplace_back(string(path), string(hash));
+        runSize += line.size() + 2 * sizeof(string);
+        if (runSize >= runBytes)
+            flushRun();
+    }
+    flushRun();
+
+    // Merge the runs; for equal paths the later run comes later and wins
+    vector<ifstream> inputs;
+    for (const auto &file : runFiles)
+        inputs.emplace_back(file, ios::binary);
+    using Head = tuple<string, size_t, string>; // path, run, hash
+    priority_queue<Head, vector<Head>, greater<Head>> heads;
+    auto pull = [&](size_t i)
+    {
+        string runLine;
+        string_view runPath, runHash;
+        if (getline(inputs[i], runLine) && parseTreeLine(runLine, runPath, runHash))
+            heads.emplace(string(runPath), i, string(runHash));
+    };
+    for (size_t i = 0; i < inputs.size(); ++i)
+        pull(i);
+
+    string sortedFile = spillFileName("treesort");
+    ofstream out(sortedFile, ios::binary);
+    string lastPath, lastHash;
+    while (!heads.empty())
+    {
+        auto [headPath, runIndex, headHash] = heads.top();
+        heads.pop();
+        if (!lastPath.empty() && headPath != lastPath)
+            out << "tree " << lastHash << " " << lastPath << "\n";
+        lastPath = move(headPath);
+        lastHash = move(headHash);
+        pull(runIndex);
+    }
+    if (!lastPath.empty())
+        out << "tree " << lastHash << " " << lastPath << "\n";
+    out.close();
+    inputs.clear();
+    for (const auto &file : runFiles)
+        fs::remove(file);
+    return sortedFile;
+}
+
+void TreeDiffIterator::loadInMemory(Cursor &cursor)
+{
+    // Check the order with one pass; only a misordered tree is materialized
+    bool ordered = true;
+    string_view previous;
+    for (cursor.advance(); cursor.valid && ordered; cursor.advance())
+    {
+        ordered = previous.empty() || previous < cursor.path;
+        previous = cursor.path;
+    }
+    cursor.offset = 0;
+    if (!ordered)
+    {
+        vector<pair<string_view, string_view>> entries;
+        for (cursor.advance(); cursor.valid; cursor.advance())
+            entries.emplace_back(cursor.path, cursor.hash);
+        // Like parseTreeObject, the last line for a repeated path wins
+        stable_sort(entries.begin(), entries.end(), [](const auto &a, const auto &b)
+                    { return a.first < b.first; });
+        for (const auto &entry : entries)
+        {
+            if (!cursor.sorted.empty() && cursor.sorted.back().first == entry.first)
+                cursor.sorted.back() = entry;
+            else
+                cursor.sorted.push_back(entry);
+        }
+    }
+    cursor.advance();
+}
+
+void TreeDiffIterator::openStream(Cursor &cursor, const string &file, uintmax_t offset, uintmax_t size)
+{
+    cursor.stream = ifstream(file, ios::binary);
+    cursor.stream.seekg(offset);
+    cursor.remaining = size;
+    cursor.advance();
+}
+
+// Streams a tree object, looking it up again if maintenance packed and removed
+// the loose file after it was located
+bool TreeDiffIterator::openObjectStream(Cursor &cursor, const string &hash, ObjectLocation &location)
+{
+    openStream(cursor, location.path, location.offset, location.size);
+    if (!cursor.stream.is_open() && relocateObject(hash, location))
+        openStream(cursor, location.path, location.offset, location.size);
+    return cursor.stream.is_open();
+}
+
+TreeDiffIterator::TreeDiffIterator(vector<string> treeContents)
+{
+    cursors.resize(treeContents.size()); // cursors point into their own content, so they are never moved
+    for (size_t i = 0; i < treeContents.size(); ++i)
+    {
+        cursors[i].content = move(treeContents[i]);
+        loadInMemory(cursors[i]);
+    }
+}
+
+/**
+ * @brief Diffs tree objects by hash ("" for an empty tree).
+ *
+ * @param memoryBudget Bytes the trees may take in memory together; 0 loads every
+ * tree. Each tree gets an equal share, and a tree larger than its share is
+ * streamed from the object store (and sorted on disk if it is out of order).
+ */
+TreeDiffIterator::TreeDiffIterator(const vector<string> &treeHashes, uintmax_t memoryBudget)
+{
+    cursors.resize(treeHashes.size());
+    uintmax_t share = memoryBudget / max<size_t>(1, 2 * treeHashes.size());
+    for (size_t i = 0; i < treeHashes.size(); ++i)
+    {
+        Cursor &cursor = cursors[i];
+        ObjectLocation location;
+        if (treeHashes[i].empty() || !locateObject(treeHashes[i], location))
+            continue;
+        if (memoryBudget == 0 || location.size <= share)
+        {
+            cursor.content = readObject(treeHashes[i]);
+            loadInMemory(cursor);
+            continue;
+        }
+
+        // Check the order while streaming; out-of-order trees are sorted on disk
+        bool streamed = openObjectStream(cursor, treeHashes[i], location);
+        bool ordered = true;
+        for (string previous; streamed && cursor.valid && ordered; cursor.advance())
+        {
+            ordered = previous.empty() || previous < cursor.path;
+            previous.assign(cursor.path.data(), cursor.path.size());
+        }
+        if (streamed && ordered)
+            streamed = openObjectStream(cursor, treeHashes[i], location);
+        else if (streamed)
+        {
+            cursor.spillPath = sortTreeOnDisk(treeHashes[i], location, max<uintmax_t>(share, TREE_STREAM_BUFFER));
+            openStream(cursor, cursor.spillPath, 0, fs::file_size(cursor.spillPath));
+        }
+        // A tree that cannot be streamed is read whole rather than taken as empty
+        if (!streamed)
+        {
+            cursor.content = readObject(treeHashes[i]);
+            loadInMemory(cursor);
+        }
+    }
+}
+
+TreeDiffIterator::~TreeDiffIterator()
+{
+    for (auto &cursor : cursors)
+    {
+        if (!cursor.spillPath.empty())
+        {
+            cursor.stream.close();
+            error_code ec;
+            fs::remove(cursor.spillPath, ec);
+        }
+    }
+}
+
+void TreeDiffIterator::Cursor::advance()
+{
+    valid = false;
+    if (!sorted.empty())
+    {
+        if (index < sorted.size())
+        {
+            tie(path, hash) = sorted[index++];
+            valid = true;
+        }
+        return;
+    }
+    if (stream.is_open())
+    {
+        while (!valid && remaining > 0 && getline(stream, line))
+        {
+            remaining -= min<uintmax_t>(remaining, line.size() + 1);
+            valid = parseTreeLine(line, path, hash);
+        }
+        return;
+    }
+    while (!valid && offset < content.size())
+    {
+        size_t end = content.find('\n', offset);
+        if (end == string::npos)
+            end = content.size();
+        valid = parseTreeLine(string_view(content).substr(offset, end - offset), path, hash);
+        offset = end + 1;
+    }
+}
+
+/**
+ * @brief Moves to the next path whose blob is not the same in every tree.
+ *
+ * @param entry Receives the path and one hash per tree ("" where the path is absent).
+ * @return false once every tree is exhausted; callers may also simply stop early.
+ */
+bool TreeDiffIterator::next(TreeEntryDiff &entry)
+{
+    entry.hashes.resize(cursors.size());
+    while (true)
+    {
+        const string_view *smallest = nullptr;
+        for (const auto &cursor : cursors)
+        {
+            if (cursor.valid && (!smallest || cursor.path < *smallest))
+                smallest = &cursor.path;
+        }
+        if (!smallest)
+            return false;
+
+        // A streamed cursor's path lives in its line buffer, which advancing reuses
+        current.assign(smallest->data(), smallest->size());
+        string_view firstHash;
+        bool differs = false;
+        for (const auto &cursor : cursors)
+        {
+            if (!cursor.valid || cursor.path != current)
+                differs = true;
+            else if (firstHash.empty())
+                firstHash = cursor.hash;
+            else if (cursor.hash != firstHash)
+                differs = true;
+        }
+        if (differs)
+        {
+            entry.path = current;
+            for (size_t i = 0; i < cursors.size(); ++i)
+            {
+                if (cursors[i].valid && cursors[i].path == current)
+                    entry.hashes[i].assign(cursors[i].hash.data(), cursors[i].hash.size());
+                else
+                    entry.hashes[i].clear();
+            }
+        }
+        for (auto &cursor : cursors)
+        {
+            if (cursor.valid && cursor.path == current)
+                cursor.advance();
+        }
+        if (differs)
+            return true;
+    }
+}
+
+// Hash of a commit's tree object; empty for an empty commit hash
+string treeHashOf(const string &commitHash)
+{
+    if (commitHash.empty())
+        return "";
+    return getTreeHashFromCommit(readObject(commitHash));
+}
+
+// Stores tree content as an object unless it already exists and returns its hash
+string writeTreeContent(const string &treeContent)
+{
+    string treeHash = generateHash(treeContent);
+    if (!objectExists(treeHash))
+        writeFile(objectPath(treeHash), treeContent);
+    return treeHash;
+}
+
+/**
+ * @brief Writes a copy of a tree with some entries replaced, added or removed.
+ *
+ * The tree is streamed through TreeDiffIterator under the memory budget and the
+ * result is hashed while it is written to a temporary file, so neither tree is
+ * held in memory.
+ *
+ * @param treeHash The tree to start from ("" for an empty tree).
+ * @param changes Changes in path order; the last hash of each is the new blob, or
+ * "" to remove the path.
+ * @return The hash of the new tree.
+ * @throws runtime_error if the tree cannot be written.
+ */
+string writeTreeWithChanges(const string &treeHash, const vector<TreeEntryDiff> &changes)
+{
+    // Against an empty tree every entry differs, so this yields the whole tree in order
+    TreeDiffIterator tree({treeHash, ""}, memoryBudget());
+    string tempPath = spillFileName("tree");
+    ofstream out(tempPath, ios::binary);
+    EVP_MD_CTX *sha = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(sha, EVP_sha1(), nullptr);
+
+    string block;
+    auto emit = [&](const string &path, const string &hash)
+    {
+        if (hash.empty())
+            return;
+        block += "tree " + hash + " " + path + "\n";
+        if (block.size() >= TREE_STREAM_BUFFER)
+        {
+            EVP_DigestUpdate(sha, block.data(), block.size());
+            out << block;
+            block.clear();
+        }
+    };
+
+    TreeEntryDiff entry;
+    bool haveEntry = tree.next(entry);
+    size_t j = 0;
+    while (haveEntry || j < changes.size())
+    {
+        if (j >= changes.size() || (haveEntry && entry.path < changes[j].path))
+        {
+            emit(entry.path, entry.hashes[0]);
+            haveEntry = tree.next(entry);
+        }
+        else
+        {
+            if (haveEntry && entry.path == changes[j].path)
+                haveEntry = tree.next(entry);
+            emit(changes[j].path, changes[j].hashes.back());
+            j++;
+        }
+    }
+    EVP_DigestUpdate(sha, block.data(), block.size());
+    out << block;
+    out.close();
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    EVP_DigestFinal_ex(sha, digest, &digestLength);
+    EVP_MD_CTX_free(sha);
+    string newHash;
+    char hex[3];
+    for (unsigned int i = 0; i < digestLength; ++i)
+    {
+        snprintf(hex, sizeof(hex), "%02x", digest[i]);
+        newHash += hex;
+    }
+
+    if (!out)
+    {
+        fs::remove(tempPath);
+        throw runtime_error("Failed to write tree object");
+    }
+    if (objectExists(newHash))
+        fs::remove(tempPath);
+    else
+        fs::rename(tempPath, objectPath(newHash));
+    return newHash;
+}
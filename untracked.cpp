@@ -0,0 +1,207 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <filesystem>
+#include <sys/stat.h>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// The untracked cache remembers, for every directory of the working tree, its
+// mtime and the names it contained. A directory's mtime changes whenever an entry
+// is added, removed or renamed in it, so only directories whose mtime differs from
+// the cached one have to be listed again. Stored next to the index as:
+//   @ <mtime ns> <directory>
+//   f <file name>
+//   d <subdirectory name>
+
+struct CachedDirectory
+{
+    long long mtime = 0;
+    vector<string> files;
+    vector<string> subdirs;
+};
+
+// Directories modified this recently are not trusted from the cache, since more
+// changes within the same timestamp granularity would not move their mtime
+const long long RACY_WINDOW_NS = 2000000000LL;
+
+static long long directoryMtime(const string &dir)
+{
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0)
+        return -1;
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static unordered_map<string, CachedDirectory> loadUntrackedCache()
+{
+    unordered_map<string, CachedDirectory> cache;
+    ifstream file(gitPath("untracked-cache"));
+    string line;
+    CachedDirectory *current = nullptr;
+    while (getline(file, line))
+    {
+        if (line.size() < 2)
+            continue;
+        if (line[0] == '@')
+        {
+            istringstream iss(line.substr(2));
+            long long mtime;
+            iss >> mtime;
+            string dir;
+            getline(iss >> ws, dir);
+            current = &cache[dir == "." ? "" : dir];
+            current->mtime = mtime;
+        }
+        else if (current && line[0] == 'f')
+            current->files.push_back(line.substr(2));
+        else if (current && line[0] == 'd')
+            current->subdirs.push_back(line.substr(2));
+    }
+    return cache;
+}
+
+static void saveUntrackedCache(const unordered_map<string, CachedDirectory> &cache)
+{
+    long long now = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    stringstream content;
+    for (const auto &[dir, entry] : cache)
+    {
+        if (now - entry.mtime < RACY_WINDOW_NS)
+            continue;
+        content << "@ " << entry.mtime << " " << (dir.empty() ? "." : dir) << "\n";
+        for (const auto &name : entry.files)
+            content << "f " << name << "\n";
+        for (const auto &name : entry.subdirs)
+            content << "d " << name << "\n";
+    }
+
+    string path = gitPath("untracked-cache");
+    try
+    {
+        writeFile(path + ".tmp", content.str());
+        fs::rename(path + ".tmp", path);
+    }
+    catch (const exception &e)
+    {
+        // The cache is only an optimization
+    }
+}
+
+/**
+ * @brief Lists every file in the working tree, outside .minigit.
+ *
+ * Every directory is still stat'ed, but only directories whose mtime changed since
+ * the last call are read again; the names in the others come from the untracked cache.
+ *
+ * @return Paths relative to the top of the working tree.
+ */
+set<string> listWorkingFiles()
+{
+    unordered_map<string, CachedDirectory> cache = loadUntrackedCache();
+    unordered_map<string, CachedDirectory> updated;
+    set<string> files;
+    bool changed = false;
+
+    vector<string> pending = {""};
+    while (!pending.empty())
+    {
+        string dir = pending.back();
+        pending.pop_back();
+        string diskDir = dir.empty() ? "." : dir;
+        long long mtime = directoryMtime(diskDir);
+        if (mtime < 0)
+            continue;
+
+        auto cached = cache.find(dir);
+        CachedDirectory entry;
+        if (cached != cache.end() && cached->second.mtime == mtime)
+            entry = move(cached->second);
+        else
+        {
+            changed = true;
+            entry.mtime = mtime;
+            error_code ec;
+            for (const auto &item : fs::directory_iterator(diskDir, ec))
+            {
+                string name = item.path().filename().string();
+                if (dir.empty() && name == ".minigit")
+                    continue;
+                if (item.is_directory() && !item.is_symlink())
+                    entry.subdirs.push_back(name);
+                else
+                    entry.files.push_back(name);
+            }
+        }
+
+        string prefix = dir.empty() ? "" : dir + "/";
+        for (const auto &name : entry.files)
+            files.insert(prefix + name);
+        for (const auto &name : entry.subdirs)
+            pending.push_back(prefix + name);
+        updated[dir] = move(entry);
+    }
+
+    if (changed || updated.size() != cache.size())
+        saveUntrackedCache(updated);
+    return files;
+}
+
+// Files in the working tree that are neither in the given tree nor staged
+set<string> getUntrackedFiles(const map<string, string> &trackedFiles)
+{
+    map<string, string> staged = readIndexEntries();
+    function<bool(const string &)> inSparse = sparseMatcher();
+    set<string> untracked;
+    for (const auto &path : listWorkingFiles())
+    {
+        if (trackedFiles.count(path) == 0 && staged.count(path) == 0 && inSparse(path))
+            untracked.insert(path);
+    }
+    return untracked;
+}
+
+/**
+ * @brief Shows staged changes, unstaged modifications and untracked files.
+ */
+void status()
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    map<string, string> tracked = getCurrentTrackedFiles();
+    map<string, string> staged = readIndexEntries();
+
+    cout << "Changes to be committed:\n";
+    for (const auto &[path, hash] : staged)
+    {
+        auto it = tracked.find(path);
+        if (it == tracked.end())
+            cout << "  new file:   " << path << "\n";
+        else if (it->second != hash)
+            cout << "  modified:   " << path << "\n";
+    }
+
+    // Compare the working tree against the index where a path is staged
+    map<string, string> expected = tracked;
+    for (const auto &[path, hash] : staged)
+        expected[path] = hash;
+    cout << "\nChanges not staged for commit:\n";
+    for (const auto &file : getModifiedFiles(expected))
+        cout << "  " << file << "\n";
+
+    cout << "\nUntracked files:\n";
+    for (const auto &path : getUntrackedFiles(tracked))
+        cout << "  " << path << "\n";
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include "helpers.hpp"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Administrative directories of the main working tree and every linked worktree
+vector<string> worktreeGitDirs()
+{
+    vector<string> dirs = {commonDir()};
+    string linked = commonPath("worktrees");
+    if (fs::exists(linked))
+    {
+        for (const auto &entry : fs::directory_iterator(linked))
+        {
+            if (entry.is_directory())
+                dirs.push_back(entry.path().string());
+        }
+    }
+    return dirs;
+}
+
+/**
+ * @brief Creates a linked working tree for a branch that shares this repository's
+ * objects, refs and config.
+ *
+ * The new tree gets its own HEAD and index under .minigit/worktrees/<name> of the
+ * main repository, and a .minigit file pointing there. A branch can only be
+ * checked out in one working tree at a time.
+ *
+ * @param directory Where to create the new working tree; must not exist yet.
+ * @param branch_name The existing branch to check out there.
+ */
+void worktreeAdd(const string &directory, const string &branch_name)
+{
+    if (!fs::exists(".minigit"))
+    {
+        cerr << "Error: No MiniGit repository found. Use 'init' to create one.\n";
+        return;
+    }
+
+    string branchRef = "refs/heads/" + branch_name;
+    string commitHash = trim(readFile(commonPath(branchRef)));
+    if (!fileExists(commonPath(branchRef)))
+    {
+        cerr << "fatal: invalid reference: " << branch_name << "\n";
+        return;
+    }
+    if (fs::exists(directory))
+    {
+        cerr << "fatal: '" << directory << "' already exists.\n";
+        return;
+    }
+    for (const auto &dir : worktreeGitDirs())
+    {
+        if (trim(readFile(dir + "/HEAD")) == "ref: " + branchRef)
+        {
+            cerr << "fatal: '" << branch_name << "' is already checked out at '" << dir << "'.\n";
+            return;
+        }
+    }
+
+    fs::path worktreePath = fs::absolute(directory).lexically_normal();
+    string name = worktreePath.filename().string();
+    fs::path adminDir = fs::absolute(commonPath("worktrees/" + name)).lexically_normal();
+    for (int suffix = 1; fs::exists(adminDir); ++suffix)
+        adminDir = fs::absolute(commonPath("worktrees/" + name + to_string(suffix))).lexically_normal();
+
+    try
+    {
+        fs::create_directories(worktreePath);
+        writeFile((adminDir / "HEAD").string(), "ref: " + branchRef);
+        writeFile((adminDir / "index").string(), "");
+        writeFile((adminDir / "commondir").string(), fs::absolute(commonDir()).lexically_normal().string() + "\n");
+        writeFile((adminDir / "gitdir").string(), (worktreePath / ".minigit").string() + "\n");
+        writeFile((worktreePath / ".minigit").string(), "gitdir: " + adminDir.string() + "\n");
+
+        // Populate the new tree straight from the shared object store
+        map<string, string> files;
+        if (!commitHash.empty())
+            files = parseTreeObject(readObject(getTreeHashFromCommit(readObject(commitHash))));
+        vector<string> blobHashes;
+        vector<pair<string, string>> outputs;
+        for (const auto &[path, hash] : files)
+            blobHashes.push_back(hash);
+        vector<bool> failed;
+        vector<string> blobs = readObjectsBatch(blobHashes, &failed);
+        size_t i = 0;
+        for (const auto &[path, hash] : files)
+        {
+            if (failed[i])
+                throw runtime_error("Missing blob " + hash + " for " + path);
+            outputs.emplace_back((worktreePath / path).string(), move(blobs[i++]));
+        }
+        writeFilesBatch(outputs);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error creating worktree: " << e.what() << "\n";
+        return;
+    }
+
+    cout << "Preparing worktree at " << worktreePath.string() << " (checking out '" << branch_name << "')\n";
+}
+
+// Lists every working tree with the commit and branch it has checked out
+void worktreeList()
+{
+    for (const auto &dir : worktreeGitDirs())
+    {
+        string location = dir == commonDir() ? fs::absolute(commonDir()).parent_path().string()
+                                             : fs::path(trim(readFile(dir + "/gitdir"))).parent_path().string();
+        string head = trim(readFile(dir + "/HEAD"));
+        string commit = head;
+        string label = "(detached HEAD)";
+        if (head.rfind("ref: ", 0) == 0)
+        {
+            commit = trim(readFile(commonPath(head.substr(5))));
+            label = "[" + head.substr(5 + string("refs/heads/").size()) + "]";
+        }
+        cout << location << "  " << (commit.empty() ? string(40, '0') : commit) << " " << label << "\n";
+    }
+}